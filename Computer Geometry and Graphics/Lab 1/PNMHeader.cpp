@@ -0,0 +1,247 @@
+#include "PNMHeader.h"
+#include <stdexcept>
+#include <istream>
+#include <string>
+#include <utility>
+
+namespace {
+    const uint64_t MaxDimension = 1ull << 32;
+    const uint64_t MaxColourDepth = 65535;
+    const uint64_t MaxPAMDepth = 4;
+
+    bool isSpace(byte c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+    }
+
+    bool isDigit(byte c) {
+        return '0' <= c && c <= '9';
+    }
+}
+
+uint64_t PNMHeader::channels() const {
+    return Type == 7 ? Depth : Type == 6 ? 3 : 1;
+}
+
+bool PNMHeader::hasAlpha() const {
+    const std::string suffix = "_ALPHA";
+    return Type == 7 && TupleType.size() > suffix.size() &&
+           TupleType.compare(TupleType.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+uint64_t PNMHeader::bytesPerSample() const {
+    return ColourDepth > 255 ? 2 : 1;
+}
+
+namespace {
+    // Byte sources for readHeader: a buffer in memory and a stream we can not rewind.
+    struct BufferSource {
+        const byte* Data;
+        uint64_t Size;
+        uint64_t Pos = 0;
+
+        int peek() const { return Pos < Size ? Data[Pos] : -1; }
+        void next() { Pos++; }
+        uint64_t position() const { return Pos; }
+    };
+
+    struct StreamSource {
+        std::istream& Stream;
+        uint64_t Pos = 0;
+
+        int peek() const { return Stream.peek(); }
+        void next() { Stream.get(); Pos++; }
+        uint64_t position() const { return Pos; }
+    };
+
+    // PAM keeps one "KEYWORD value" per line and ends the header with an ENDHDR line.
+    template<typename Source, typename Skip, typename Number>
+    void readPAMFields(Source& src, PNMHeader& header, Skip& skip, Number& number) {
+        auto word = [&]() -> std::string {
+            std::string text;
+            while (src.peek() != -1 && !isSpace(src.peek())) {
+                text += (char)src.peek();
+                src.next();
+            }
+            return text;
+        };
+        bool hasMaxval = false;
+        while (true) {
+            skip();
+            if (src.peek() == -1) {
+                throw std::runtime_error("Error: Unexpected EOF!");
+            }
+            std::string keyword = word();
+            if (keyword == "ENDHDR") {
+                // the raster starts right after the end of this line
+                while (src.peek() != -1 && src.peek() != '\n') {
+                    if (!isSpace(src.peek())) {
+                        throw std::runtime_error("Error: unable to read this file format!");
+                    }
+                    src.next();
+                }
+                if (src.peek() == -1) {
+                    throw std::runtime_error("Error: Unexpected EOF!");
+                }
+                src.next();
+                break;
+            } else if (keyword == "WIDTH") {
+                header.Width = number(MaxDimension);
+            } else if (keyword == "HEIGHT") {
+                header.Height = number(MaxDimension);
+            } else if (keyword == "DEPTH") {
+                header.Depth = number(MaxPAMDepth);
+            } else if (keyword == "MAXVAL") {
+                header.ColourDepth = number(MaxColourDepth);
+                hasMaxval = true;
+            } else if (keyword == "TUPLTYPE") {
+                // the rest of the line, several TUPLTYPE lines are joined with a space
+                while (src.peek() == ' ' || src.peek() == '\t') {
+                    src.next();
+                }
+                std::string type;
+                while (src.peek() != -1 && src.peek() != '\n' && src.peek() != '\r') {
+                    type += (char)src.peek();
+                    src.next();
+                }
+                while (!type.empty() && isSpace(type.back())) {
+                    type.pop_back();
+                }
+                header.TupleType += (header.TupleType.empty() ? "" : " ") + type;
+            } else {
+                throw std::runtime_error("Error: unable to read this file format!");
+            }
+        }
+        if (header.Width == 0 || header.Height == 0 || header.Depth == 0 || !hasMaxval || header.ColourDepth == 0) {
+            throw std::runtime_error("Error: unable to read this file format!");
+        }
+
+        // the tuple types we know fix the depth, the others are taken as they are
+        const std::pair<const char*, uint64_t> known[] = {
+                {"BLACKANDWHITE", 1}, {"GRAYSCALE", 1}, {"RGB", 3},
+                {"BLACKANDWHITE_ALPHA", 2}, {"GRAYSCALE_ALPHA", 2}, {"RGB_ALPHA", 4}
+        };
+        for (const auto& [name, depth] : known) {
+            if (header.TupleType == name && header.Depth != depth) {
+                throw std::runtime_error("Error: TUPLTYPE does not match DEPTH!");
+            }
+        }
+    }
+
+    template<typename Source>
+    PNMHeader readHeader(Source& src) {
+        PNMHeader header;
+
+        // whitespace and comments between tokens, a comment runs to the next CR or LF
+        auto skipComment = [&]() {
+            while (src.peek() != -1 && src.peek() != '\n' && src.peek() != '\r') {
+                src.next();
+            }
+        };
+        auto skip = [&]() {
+            while (src.peek() != -1) {
+                if (isSpace(src.peek())) {
+                    src.next();
+                } else if (src.peek() == '#') {
+                    skipComment();
+                } else {
+                    break;
+                }
+            }
+        };
+        auto number = [&](uint64_t limit) -> uint64_t {
+            skip();
+            if (src.peek() == -1) {
+                throw std::runtime_error("Error: Unexpected EOF!");
+            }
+            if (src.peek() == '-') {
+                throw std::runtime_error("Error: negative numbers in header!");
+            }
+            if (!isDigit(src.peek())) {
+                throw std::runtime_error("Error: unable to read this file format!");
+            }
+            uint64_t value = 0;
+            while (src.peek() != -1 && isDigit(src.peek())) {
+                value = value * 10 + (src.peek() - '0');
+                if (value > limit) {
+                    throw std::runtime_error("Error: header value is too large!");
+                }
+                src.next();
+            }
+            if (src.peek() == -1) {
+                throw std::runtime_error("Error: Unexpected EOF!");
+            }
+            if (!isSpace(src.peek()) && src.peek() != '#') {
+                throw std::runtime_error("Error: unable to read this file format!");
+            }
+            return value;
+        };
+
+        //MAGIC
+        if (src.peek() != 'P') {
+            throw std::runtime_error("Error: unable to read this file format!");
+        }
+        src.next();
+        if (src.peek() != '5' && src.peek() != '6' && src.peek() != '7') {
+            throw std::runtime_error("Error: unable to read this file format!");
+        }
+        header.Type = src.peek() - '0';
+        src.next();
+        if (src.peek() == -1 || (!isSpace(src.peek()) && src.peek() != '#')) {
+            throw std::runtime_error("Error: unable to read this file format!");
+        }
+
+        if (header.Type == 7) {
+            readPAMFields(src, header, skip, number);
+        } else {
+            //FIELDS
+            header.Width = number(MaxDimension);
+            header.Height = number(MaxDimension);
+            header.ColourDepth = number(MaxColourDepth);
+            if (header.Width == 0 || header.Height == 0 || header.ColourDepth == 0) {
+                throw std::runtime_error("Error: unable to read this file format!");
+            }
+
+            // exactly one whitespace after maxval, or a comment ending in one
+            if (src.peek() == '#') {
+                skipComment();
+                if (src.peek() == -1) {
+                    throw std::runtime_error("Error: Unexpected EOF!");
+                }
+            }
+            src.next();
+        }
+
+        header.DataOffset = src.position();
+        uint64_t rowSize = header.rowSize();
+        if (rowSize > UINT64_MAX / header.Height) {
+            throw std::runtime_error("Error: header value is too large!");
+        }
+        header.DataSize = rowSize * header.Height;
+        return header;
+    }
+}
+
+uint64_t PNMHeader::rowSize() const {
+    return Width * channels() * bytesPerSample();
+}
+
+std::string PNMHeader::format() const {
+    if (Type == 7) {
+        return "P7\nWIDTH " + std::to_string(Width) + "\nHEIGHT " + std::to_string(Height) +
+               "\nDEPTH " + std::to_string(Depth) + "\nMAXVAL " + std::to_string(ColourDepth) + "\n" +
+               (TupleType.empty() ? "" : "TUPLTYPE " + TupleType + "\n") + "ENDHDR\n";
+    }
+    return "P" + std::to_string(Type) + "\n" +
+           std::to_string(Width) + " " + std::to_string(Height) + "\n" +
+           std::to_string(ColourDepth) + "\n";
+}
+
+PNMHeader PNMHeader::parse(const byte* data, uint64_t size) {
+    BufferSource src{data, size};
+    return readHeader(src);
+}
+
+PNMHeader PNMHeader::read(std::istream& is) {
+    StreamSource src{is};
+    return readHeader(src);
+}
@@ -0,0 +1,645 @@
+#include "Resample.h"
+#include "PixelKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace {
+    const double Pi = 3.14159265358979323846;
+
+    // Buckets of linear values per stored value, sRGB is steepest near black at 12.92
+    // stored values per linear one, so a bucket rarely holds more than a few thresholds.
+    const uint64_t BucketsPerValue = 4;
+
+    // cosine and sine of degrees, exact on the multiples of 90 so right angles stay whole
+    void turn(double degrees, double& cosine, double& sine) {
+        double reduced = std::fmod(degrees, 360.0);
+        if (reduced < 0) {
+            reduced += 360;
+        }
+        if (reduced == 0 || reduced == 90 || reduced == 180 || reduced == 270) {
+            int quarter = (int)(reduced / 90);
+            const double cosines[] = {1, 0, -1, 0};
+            cosine = cosines[quarter];
+            sine = cosines[(quarter + 3) % 4];
+            return;
+        }
+        cosine = std::cos(reduced * Pi / 180);
+        sine = std::sin(reduced * Pi / 180);
+    }
+
+    // Everything a band of destination rows needs, copied out of the Resampler.
+    struct RowJob {
+        const byte* Data;
+        uint64_t Width, Height, ColourDepth;
+        const LinearLight* Light;
+        const byte* Background;
+        const float* LinearBackground;
+        byte* Dst;
+        uint64_t NewWidth;
+        const WarpMap* Map;      // the positions are worked out from Map, or read from Table when it is null
+        const RemapTable* Table;
+        uint64_t FirstRow, Count;
+
+        void positions(uint64_t y, double* xs, double* ys) const {
+            if (Map) {
+                Map->row(y, NewWidth, xs, ys);
+            } else {
+                Table->row(y, xs, ys);
+            }
+        }
+    };
+
+    // Weights of the Taps source pixels around a position t past the first of the middle two.
+    template<int Taps>
+    void weights(float t, float* w);
+
+    template<>
+    void weights<2>(float t, float* w) {
+        w[0] = 1 - t;
+        w[1] = t;
+    }
+
+    template<>
+    void weights<4>(float t, float* w) {
+        // Catmull-Rom, a = -0.5: passes through the pixels and overshoots a little at edges
+        float t2 = t * t, t3 = t2 * t;
+        w[0] = -0.5f * t3 + t2 - 0.5f * t;
+        w[1] = 1.5f * t3 - 2.5f * t2 + 1;
+        w[2] = -1.5f * t3 + 2 * t2 + 0.5f * t;
+        w[3] = 0.5f * t3 - 0.5f * t2;
+    }
+
+    // where positions behind the viewer or at infinity go, far outside any source
+    // and still a whole number of 64 bits
+    const double Far = 1e15;
+
+    // a position kept within Far so floorOf can truncate it, an overflow to NaN goes to Far as well
+    double bounded(double value) {
+        return std::max(-Far, std::min(Far, value));
+    }
+
+    // std::floor is a library call without SSE4.1, a truncation and a compare are not
+    double floorOf(double value) {
+        auto whole = (double)(int64_t)value;
+        return whole > value ? whole - 1 : whole;
+    }
+
+    // one source pixel in linear light, colour premultiplied by alpha
+    template<typename Sample, uint64_t C, bool A>
+    void loadLinear(const byte* p, const LinearLight& light, float alphaScale, float* px) {
+        float alpha = A ? Sample::load(p + (C - 1) * Sample::Bytes) * alphaScale : 1;
+        for (uint64_t c = 0; c < (A ? C - 1 : C); c++) {
+            px[c] = light.decode(Sample::load(p + c * Sample::Bytes)) * alpha;
+        }
+        if (A) {
+            px[C - 1] = alpha;
+        }
+    }
+
+    template<typename Sample, uint64_t C, bool A>
+    void storeLinear(const float* px, const LinearLight& light, uint64_t maxval, byte* p) {
+        float alpha = A ? std::clamp(px[C - 1], 0.0f, 1.0f) : 1;
+        for (uint64_t c = 0; c < (A ? C - 1 : C); c++) {
+            float value = A ? (alpha > 0 ? px[c] / alpha : 0) : px[c];
+            Sample::store(p + c * Sample::Bytes, light.encode(value));
+        }
+        if (A) {
+            Sample::store(p + (C - 1) * Sample::Bytes, (uint32_t)std::lround(alpha * maxval));
+        }
+    }
+
+    // Bilinear and bicubic: Taps x Taps source pixels mixed in linear light. Pixels with every tap
+    // inside the source skip the bounds checks, pixels with none take the background as it is.
+    template<typename Sample, uint64_t C, bool A, int Taps>
+    void mixRows(const RowJob& job) {
+        const uint64_t pixelSize = C * Sample::Bytes;
+        const auto width = (int64_t)job.Width, height = (int64_t)job.Height;
+        const float alphaScale = 1.0f / job.ColourDepth;
+        const LinearLight& light = *job.Light;
+        std::vector<double> xs(job.NewWidth), ys(job.NewWidth);
+        for (uint64_t y = job.FirstRow; y < job.FirstRow + job.Count; y++) {
+            job.positions(y, xs.data(), ys.data());
+            byte* out = job.Dst + (y - job.FirstRow) * job.NewWidth * pixelSize;
+            for (uint64_t x = 0; x < job.NewWidth; x++, out += pixelSize) {
+                double fx = floorOf(xs[x]), fy = floorOf(ys[x]);
+                if (fx < -Taps / 2 || fy < -Taps / 2 || fx >= width + Taps / 2 - 1 || fy >= height + Taps / 2 - 1) {
+                    std::memcpy(out, job.Background, pixelSize);
+                    continue;
+                }
+                int64_t left = (int64_t)fx - (Taps / 2 - 1), top = (int64_t)fy - (Taps / 2 - 1);
+                float wx[Taps], wy[Taps];
+                weights<Taps>((float)(xs[x] - fx), wx);
+                weights<Taps>((float)(ys[x] - fy), wy);
+                bool inside = left >= 0 && top >= 0 && left + Taps <= width && top + Taps <= height;
+                float sum[C] = {};
+                for (int i = 0; i < Taps; i++) {
+                    int64_t sy = top + i;
+                    float row[C] = {};
+                    for (int j = 0; j < Taps; j++) {
+                        int64_t sx = left + j;
+                        float px[C];
+                        if (inside || (sx >= 0 && sy >= 0 && sx < width && sy < height)) {
+                            loadLinear<Sample, C, A>(job.Data + (sy * width + sx) * pixelSize, light, alphaScale, px);
+                        } else {
+                            std::copy(job.LinearBackground, job.LinearBackground + C, px);
+                        }
+                        for (uint64_t c = 0; c < C; c++) {
+                            row[c] += wx[j] * px[c];
+                        }
+                    }
+                    for (uint64_t c = 0; c < C; c++) {
+                        sum[c] += wy[i] * row[c];
+                    }
+                }
+                storeLinear<Sample, C, A>(sum, light, job.ColourDepth, out);
+            }
+        }
+    }
+
+    // Calls f(channels, alpha) with both as compile time constants, so a kernel is compiled
+    // once per pixel format and its channel loops unroll.
+    template<typename F>
+    void withFormat(uint64_t channels, bool alpha, F&& f) {
+        auto withAlpha = [&](auto c) {
+            if (alpha) {
+                f(c, std::true_type{});
+            } else {
+                f(c, std::false_type{});
+            }
+        };
+        switch (channels) {
+            case 1: withAlpha(std::integral_constant<uint64_t, 1>{}); break;
+            case 2: withAlpha(std::integral_constant<uint64_t, 2>{}); break;
+            case 3: withAlpha(std::integral_constant<uint64_t, 3>{}); break;
+            default: withAlpha(std::integral_constant<uint64_t, 4>{}); break;
+        }
+    }
+
+    // the filter of a resize at x source pixels from the centre of a destination pixel, scale 1
+    double filterAt(Filter filter, double x) {
+        x = std::abs(x);
+        switch (filter) {
+            case Filter::Box:
+                return x < 0.5 ? 1 : 0;
+            case Filter::Bilinear:
+                return x < 1 ? 1 - x : 0;
+            case Filter::Bicubic:
+                return x < 1 ? (1.5 * x - 2.5) * x * x + 1 : x < 2 ? ((-0.5 * x + 2.5) * x - 4) * x + 2 : 0;
+            case Filter::Lanczos:
+                if (x == 0) {
+                    return 1;
+                }
+                return x < 3 ? 3 * std::sin(Pi * x) * std::sin(Pi * x / 3) / (Pi * Pi * x * x) : 0;
+            default:
+                return 0;
+        }
+    }
+
+    double filterRadius(Filter filter) {
+        switch (filter) {
+            case Filter::Box: return 0.5;
+            case Filter::Bilinear: return 1;
+            case Filter::Bicubic: return 2;
+            case Filter::Lanczos: return 3;
+            default: return 0;
+        }
+    }
+
+    // The first pass of a resize: each source row in linear light, then every destination pixel
+    // of it from the Taps source pixels of the column table.
+    template<typename Sample, uint64_t C, bool A>
+    void filterRows(const byte* data, uint64_t width, uint64_t newWidth, uint64_t maxval, const LinearLight& light,
+                    const WeightTable& columns, float* between, uint64_t firstRow, uint64_t count) {
+        const uint64_t pixelSize = C * Sample::Bytes;
+        const float alphaScale = 1.0f / maxval;
+        std::vector<float> line(width * C);
+        for (uint64_t y = firstRow; y < firstRow + count; y++) {
+            const byte* row = data + y * width * pixelSize;
+            for (uint64_t x = 0; x < width; x++) {
+                loadLinear<Sample, C, A>(row + x * pixelSize, light, alphaScale, line.data() + x * C);
+            }
+            float* out = between + y * newWidth * C;
+            for (uint64_t x = 0; x < newWidth; x++, out += C) {
+                const float* weight = columns.Weights.data() + x * columns.Taps;
+                const float* in = line.data() + columns.First[x] * C;
+                float sum[C] = {};
+                for (uint64_t t = 0; t < columns.Taps; t++) {
+                    for (uint64_t c = 0; c < C; c++) {
+                        sum[c] += weight[t] * in[t * C + c];
+                    }
+                }
+                std::copy(sum, sum + C, out);
+            }
+        }
+    }
+
+    // The second pass: whole rows of the first pass weighed and added up, a loop the compiler
+    // vectorizes, then turned back into stored values.
+    template<typename Sample, uint64_t C, bool A>
+    void filterColumns(const float* between, uint64_t newWidth, uint64_t maxval, const LinearLight& light,
+                       const WeightTable& rows, byte* dst, uint64_t firstRow, uint64_t count) {
+        const uint64_t pixelSize = C * Sample::Bytes;
+        const uint64_t length = newWidth * C;
+        std::vector<float> line(length);
+        for (uint64_t y = firstRow; y < firstRow + count; y++) {
+            std::fill(line.begin(), line.end(), 0.0f);
+            for (uint64_t t = 0; t < rows.Taps; t++) {
+                float weight = rows.Weights[y * rows.Taps + t];
+                if (weight == 0) {
+                    continue;
+                }
+                const float* in = between + (rows.First[y] + t) * length;
+                float* sum = line.data();
+                for (uint64_t k = 0; k < length; k++) {
+                    sum[k] += weight * in[k];
+                }
+            }
+            byte* out = dst + (y - firstRow) * newWidth * pixelSize;
+            for (uint64_t x = 0; x < newWidth; x++) {
+                storeLinear<Sample, C, A>(line.data() + x * C, light, maxval, out + x * pixelSize);
+            }
+        }
+    }
+
+    // Nearest: the pixel is copied, no light is mixed so no conversion is needed.
+    void nearestRows(const RowJob& job, uint64_t pixelSize) {
+        const auto width = (int64_t)job.Width, height = (int64_t)job.Height;
+        std::vector<double> xs(job.NewWidth), ys(job.NewWidth);
+        for (uint64_t y = job.FirstRow; y < job.FirstRow + job.Count; y++) {
+            job.positions(y, xs.data(), ys.data());
+            byte* out = job.Dst + (y - job.FirstRow) * job.NewWidth * pixelSize;
+            for (uint64_t x = 0; x < job.NewWidth; x++, out += pixelSize) {
+                double fx = floorOf(xs[x] + 0.5), fy = floorOf(ys[x] + 0.5);
+                bool inside = fx >= 0 && fy >= 0 && fx < width && fy < height;
+                std::memcpy(out, inside ? job.Data + ((int64_t)fy * width + (int64_t)fx) * pixelSize : job.Background,
+                            pixelSize);
+            }
+        }
+    }
+
+    // the rows of job with the kernel of filter for the format
+    void sampleRows(const RowJob& job, Filter filter, uint64_t channelCount, uint64_t bytesPerSample, bool hasAlpha) {
+        if (filter == Filter::Nearest) {
+            nearestRows(job, channelCount * bytesPerSample);
+            return;
+        }
+        withSample(bytesPerSample, [&](auto sample) {
+            withFormat(channelCount, hasAlpha, [&](auto channels, auto alpha) {
+                using Sample = decltype(sample);
+                if (filter == Filter::Bilinear) {
+                    mixRows<Sample, channels, alpha, 2>(job);
+                } else {
+                    mixRows<Sample, channels, alpha, 4>(job);
+                }
+            });
+        });
+    }
+}
+
+LinearLight::LinearLight(uint64_t maxval, double gamma)
+        : Decoded(maxval + 1), Thresholds(maxval), Buckets((maxval + 1) * BucketsPerValue + 2),
+          BucketCount((maxval + 1) * BucketsPerValue) {
+    for (uint64_t value = 0; value <= maxval; value++) {
+        Decoded[value] = (float)decodeGamma((double)value / maxval, gamma);
+    }
+    // round(encodeGamma(v) * maxval) moves up to i + 1 where the encoded value passes i + 0.5
+    for (uint64_t i = 0; i < maxval; i++) {
+        Thresholds[i] = decodeGamma((i + 0.5) / maxval, gamma);
+    }
+    uint32_t code = 0;
+    for (uint64_t k = 0; k < Buckets.size(); k++) {
+        double value = (double)k / BucketCount;
+        while (code < maxval && Thresholds[code] <= value) {
+            code++;
+        }
+        Buckets[k] = code;
+    }
+}
+
+uint32_t LinearLight::encode(float value) const {
+    value = std::clamp(value, 0.0f, 1.0f);
+    // value * BucketCount is exact in double, so value lies inside bucket k and its code between
+    // the codes of the bucket edges
+    auto k = (uint64_t)((double)value * BucketCount);
+    auto first = Thresholds.begin() + Buckets[k], last = Thresholds.begin() + Buckets[k + 1];
+    return (uint32_t)(std::upper_bound(first, last, (double)value) - Thresholds.begin());
+}
+
+double LinearLight::decodeGamma(double value, double gamma) {
+    return gamma == 0 ? value <= 0.04045 ? value / 12.92 : pow((value + 0.055) / 1.055, 2.4) : pow(value, gamma);
+}
+
+double LinearLight::encodeGamma(double value, double gamma) {
+    return gamma == 0 ? value <= 0.0031308 ? 12.92 * value : 1.055 * pow(value, 1 / 2.4) - 0.055 : pow(value,
+                                                                                                       1.0 / gamma);
+}
+
+Matrix3 Matrix3::operator*(const Matrix3& other) const {
+    Matrix3 result;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            result.M[i][j] = M[i][0] * other.M[0][j] + M[i][1] * other.M[1][j] + M[i][2] * other.M[2][j];
+        }
+    }
+    return result;
+}
+
+bool Matrix3::inverse(Matrix3& result) const {
+    // the adjugate over the determinant
+    double cofactors[3][3];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            int i1 = (i + 1) % 3, i2 = (i + 2) % 3, j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+            cofactors[i][j] = M[i1][j1] * M[i2][j2] - M[i1][j2] * M[i2][j1];
+        }
+    }
+    double determinant = M[0][0] * cofactors[0][0] + M[0][1] * cofactors[0][1] + M[0][2] * cofactors[0][2];
+    if (determinant == 0 || !std::isfinite(determinant)) {
+        return false;
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            result.M[i][j] = cofactors[j][i] / determinant;
+        }
+    }
+    return true;
+}
+
+bool Matrix3::apply(double x, double y, double& resultX, double& resultY) const {
+    double w = M[2][0] * x + M[2][1] * y + M[2][2];
+    if (w <= 0) {
+        return false;
+    }
+    resultX = (M[0][0] * x + M[0][1] * y + M[0][2]) / w;
+    resultY = (M[1][0] * x + M[1][1] * y + M[1][2]) / w;
+    return true;
+}
+
+Matrix3 Matrix3::translation(double x, double y) {
+    Matrix3 result;
+    result.M[0][2] = x;
+    result.M[1][2] = y;
+    return result;
+}
+
+Matrix3 Matrix3::orientation(const Orientation& pending, uint64_t width, uint64_t height) {
+    // undo the flips on the image as shown, then the transpose swaps the axes
+    double flipX[3] = {pending.FlipX ? -1.0 : 1.0, 0, pending.FlipX ? width - 1.0 : 0};
+    double flipY[3] = {0, pending.FlipY ? -1.0 : 1.0, pending.FlipY ? height - 1.0 : 0};
+    Matrix3 result;
+    for (int j = 0; j < 3; j++) {
+        result.M[0][j] = pending.Transpose ? flipY[j] : flipX[j];
+        result.M[1][j] = pending.Transpose ? flipX[j] : flipY[j];
+    }
+    return result;
+}
+
+Matrix3 Matrix3::rotation(double degrees, uint64_t width, uint64_t height, uint64_t newWidth, uint64_t newHeight) {
+    // turning the image clockwise turns the destination grid counterclockwise over the source,
+    // y grows downwards
+    double cosine, sine;
+    turn(degrees, cosine, sine);
+    double dx = 0.5 - newWidth / 2.0, dy = 0.5 - newHeight / 2.0; // first destination pixel from the centre
+    Matrix3 result;
+    result.M[0][0] = cosine;
+    result.M[0][1] = sine;
+    result.M[0][2] = dx * cosine + dy * sine + width / 2.0 - 0.5;
+    result.M[1][0] = -sine;
+    result.M[1][1] = cosine;
+    result.M[1][2] = -dx * sine + dy * cosine + height / 2.0 - 0.5;
+    return result;
+}
+
+WarpMap::WarpMap(const Matrix3& toSource) {
+    // a matrix and its negative are the same map, w is kept positive in front of the viewer
+    double sign = toSource.M[2][2] < 0 ? -1 : 1;
+    X = sign * toSource.M[0][2];
+    Y = sign * toSource.M[1][2];
+    W = sign * toSource.M[2][2];
+    XStep = sign * toSource.M[0][0];
+    YStep = sign * toSource.M[1][0];
+    WStep = sign * toSource.M[2][0];
+    XRowStep = sign * toSource.M[0][1];
+    YRowStep = sign * toSource.M[1][1];
+    WRowStep = sign * toSource.M[2][1];
+}
+
+bool WarpMap::isAffine() const {
+    return WStep == 0 && WRowStep == 0 && W == 1;
+}
+
+void WarpMap::row(uint64_t y, uint64_t count, double* xs, double* ys) const {
+    double x0 = X + y * XRowStep, y0 = Y + y * YRowStep, w0 = W + y * WRowStep;
+    if (isAffine()) {
+        for (uint64_t x = 0; x < count; x++) {
+            xs[x] = bounded(x0 + x * XStep);
+            ys[x] = bounded(y0 + x * YStep);
+        }
+        return;
+    }
+    for (uint64_t x = 0; x < count; x++) {
+        double w = w0 + x * WStep;
+        bool front = w > 0;
+        xs[x] = front ? bounded((x0 + x * XStep) / w) : -Far;
+        ys[x] = front ? bounded((y0 + x * YStep) / w) : -Far;
+    }
+}
+
+RemapTable::RemapTable(uint64_t width, uint64_t height, uint64_t sourceWidth, uint64_t sourceHeight)
+        : Width(width), Height(height), SourceWidth(sourceWidth), SourceHeight(sourceHeight),
+          Positions(width * height * 2) {}
+
+void RemapTable::fill(const WarpMap& map, uint64_t firstRow, uint64_t count) {
+    std::vector<double> xs(Width), ys(Width);
+    for (uint64_t y = firstRow; y < firstRow + count; y++) {
+        map.row(y, Width, xs.data(), ys.data());
+        float* out = Positions.data() + y * Width * 2;
+        for (uint64_t x = 0; x < Width; x++) {
+            out[2 * x] = (float)xs[x];
+            out[2 * x + 1] = (float)ys[x];
+        }
+    }
+}
+
+void RemapTable::row(uint64_t y, double* xs, double* ys) const {
+    const float* in = Positions.data() + y * Width * 2;
+    for (uint64_t x = 0; x < Width; x++) {
+        xs[x] = in[2 * x];
+        ys[x] = in[2 * x + 1];
+    }
+}
+
+void RemapTable::save(const char* path) const {
+    std::ofstream os(path, std::ios::binary);
+    os << "REMAP " << Width << " " << Height << " " << SourceWidth << " " << SourceHeight << "\n";
+    std::vector<byte> bytes(Positions.size() * 4);
+    for (uint64_t i = 0; i < Positions.size(); i++) {
+        uint32_t bits;
+        std::memcpy(&bits, &Positions[i], 4);
+        for (int k = 0; k < 4; k++) {
+            bytes[i * 4 + k] = (bits >> (8 * k)) & 0xFF;
+        }
+    }
+    os.write(reinterpret_cast<const char*>(bytes.data()), (std::streamsize)bytes.size());
+    if (!os) {
+        throw std::runtime_error("Error: unable to write the remap table!");
+    }
+}
+
+RemapTable RemapTable::load(const char* path) {
+    std::ifstream is(path, std::ios::binary);
+    std::string magic;
+    uint64_t width = 0, height = 0, sourceWidth = 0, sourceHeight = 0;
+    if (!(is >> magic >> width >> height >> sourceWidth >> sourceHeight) || magic != "REMAP" || is.get() != '\n' ||
+        width == 0 || height == 0 || width > (1ull << 32) || height > (1ull << 32) / width) {
+        throw std::runtime_error("Error: unable to read the remap table!");
+    }
+    RemapTable table(width, height, sourceWidth, sourceHeight);
+    std::vector<byte> bytes(table.Positions.size() * 4);
+    if (!is.read(reinterpret_cast<char*>(bytes.data()), (std::streamsize)bytes.size())) {
+        throw std::runtime_error("Error: the remap table is cut short!");
+    }
+    for (uint64_t i = 0; i < table.Positions.size(); i++) {
+        uint32_t bits = 0;
+        for (int k = 0; k < 4; k++) {
+            bits |= (uint32_t)bytes[i * 4 + k] << (8 * k);
+        }
+        std::memcpy(&table.Positions[i], &bits, 4);
+        // a broken position samples nothing rather than everything
+        if (!std::isfinite(table.Positions[i])) {
+            table.Positions[i] = -(float)Far;
+        }
+    }
+    return table;
+}
+
+void rotatedSize(double degrees, uint64_t width, uint64_t height, uint64_t& newWidth, uint64_t& newHeight) {
+    double cosine, sine;
+    turn(degrees, cosine, sine);
+    cosine = std::abs(cosine);
+    sine = std::abs(sine);
+    // a hair below a whole number is rounding noise, not another row of pixels
+    newWidth = std::max<uint64_t>(1, (uint64_t)std::ceil(width * cosine + height * sine - 1e-6));
+    newHeight = std::max<uint64_t>(1, (uint64_t)std::ceil(width * sine + height * cosine - 1e-6));
+}
+
+Resampler::Resampler(const PNMHeader& header, const byte* data, Filter filter, double gamma,
+                     const std::vector<uint32_t>& background)
+        : Data(data), Width(header.Width), Height(header.Height), Channels(header.channels()),
+          BytesPerSample(header.bytesPerSample()), ColourDepth(header.ColourDepth), Alpha(header.hasAlpha()),
+          Sampling(filter), Light(filter == Filter::Nearest ? 1 : header.ColourDepth, gamma),
+          Background(Channels * BytesPerSample), LinearBackground(Channels) {
+    withSample(BytesPerSample, [&](auto sample) {
+        using Sample = decltype(sample);
+        for (uint64_t c = 0; c < Channels; c++) {
+            Sample::store(Background.data() + c * Sample::Bytes, background[c]);
+        }
+        if (Sampling == Filter::Nearest) {
+            return;
+        }
+        float alpha = Alpha ? (float)background[Channels - 1] / ColourDepth : 1;
+        for (uint64_t c = 0; c < Channels; c++) {
+            LinearBackground[c] = Alpha && c == Channels - 1 ? alpha : Light.decode(background[c]) * alpha;
+        }
+    });
+}
+
+void Resampler::rows(byte* dst, uint64_t newWidth, const WarpMap& map, uint64_t firstRow, uint64_t count) const {
+    sampleRows(RowJob{Data, Width, Height, ColourDepth, &Light, Background.data(), LinearBackground.data(),
+                      dst, newWidth, &map, nullptr, firstRow, count}, Sampling, Channels, BytesPerSample, Alpha);
+}
+
+void Resampler::rows(byte* dst, const RemapTable& table, uint64_t firstRow, uint64_t count) const {
+    sampleRows(RowJob{Data, Width, Height, ColourDepth, &Light, Background.data(), LinearBackground.data(),
+                      dst, table.width(), nullptr, &table, firstRow, count}, Sampling, Channels, BytesPerSample,
+               Alpha);
+}
+
+WeightTable::WeightTable(Filter filter, uint64_t source, uint64_t destination) : First(destination) {
+    double scale = (double)source / destination;
+    if (filter == Filter::Nearest) {
+        Weights.assign(destination, 1);
+        for (uint64_t i = 0; i < destination; i++) {
+            First[i] = std::min(source - 1, (uint64_t)((i + 0.5) * scale));
+        }
+        return;
+    }
+    double stretch = std::max(1.0, scale);
+    double radius = filterRadius(filter) * stretch;
+    Taps = std::min(source, (uint64_t)std::ceil(radius * 2) + 1);
+    Weights.assign(destination * Taps, 0);
+    std::vector<double> window(Taps);
+    for (uint64_t i = 0; i < destination; i++) {
+        // source pixels whose centres lie within radius of the centre of destination pixel i,
+        // the ones past the edges are left out and the rest weigh more
+        double centre = (i + 0.5) * scale;
+        auto lo = (int64_t)std::ceil(centre - radius - 0.5), hi = (int64_t)std::floor(centre + radius - 0.5);
+        lo = std::max<int64_t>(lo, 0);
+        hi = std::min<int64_t>(hi, (int64_t)source - 1);
+        First[i] = std::min<uint64_t>(std::max<int64_t>(lo, 0), source - Taps);
+        std::fill(window.begin(), window.end(), 0.0);
+        double sum = 0;
+        for (int64_t j = lo; j <= hi; j++) {
+            double weight = filterAt(filter, (j + 0.5 - centre) / stretch);
+            window[j - First[i]] = weight;
+            sum += weight;
+        }
+        if (sum == 0) {
+            // a box narrower than a pixel can fall between two centres, the closest pixel then stands in
+            auto closest = std::min<uint64_t>(source - 1, (uint64_t)centre);
+            First[i] = std::min(closest, source - Taps);
+            window[closest - First[i]] = sum = 1;
+        }
+        for (uint64_t t = 0; t < Taps; t++) {
+            Weights[i * Taps + t] = (float)(window[t] / sum);
+        }
+    }
+}
+
+Resizer::Resizer(const PNMHeader& header, const byte* data, uint64_t newWidth, uint64_t newHeight, Filter filter,
+                 double gamma)
+        : Data(data), Width(header.Width), Height(header.Height), NewWidth(newWidth), NewHeight(newHeight),
+          Channels(header.channels()), BytesPerSample(header.bytesPerSample()), ColourDepth(header.ColourDepth),
+          Alpha(header.hasAlpha()), Sampling(filter), Light(filter == Filter::Nearest ? 1 : header.ColourDepth, gamma),
+          Columns(filter, Width, newWidth), Rows(filter, Height, newHeight) {
+    if (Sampling != Filter::Nearest) {
+        Between.resize(NewWidth * Height * Channels);
+    }
+}
+
+void Resizer::resizeRows(uint64_t firstRow, uint64_t count) {
+    if (Sampling == Filter::Nearest) {
+        return;
+    }
+    withSample(BytesPerSample, [&](auto sample) {
+        withFormat(Channels, Alpha, [&](auto channels, auto alpha) {
+            filterRows<decltype(sample), channels, alpha>(Data, Width, NewWidth, ColourDepth, Light, Columns,
+                                                          Between.data(), firstRow, count);
+        });
+    });
+}
+
+void Resizer::resizeColumns(byte* dst, uint64_t firstRow, uint64_t count) const {
+    uint64_t pixelSize = Channels * BytesPerSample;
+    if (Sampling == Filter::Nearest) {
+        for (uint64_t y = firstRow; y < firstRow + count; y++) {
+            const byte* row = Data + Rows.First[y] * Width * pixelSize;
+            byte* out = dst + (y - firstRow) * NewWidth * pixelSize;
+            for (uint64_t x = 0; x < NewWidth; x++) {
+                std::memcpy(out + x * pixelSize, row + Columns.First[x] * pixelSize, pixelSize);
+            }
+        }
+        return;
+    }
+    withSample(BytesPerSample, [&](auto sample) {
+        withFormat(Channels, Alpha, [&](auto channels, auto alpha) {
+            filterColumns<decltype(sample), channels, alpha>(Between.data(), NewWidth, ColourDepth, Light, Rows,
+                                                             dst, firstRow, count);
+        });
+    });
+}
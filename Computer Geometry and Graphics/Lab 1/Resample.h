@@ -0,0 +1,184 @@
+#ifndef LAB_1_RESAMPLE_H
+#define LAB_1_RESAMPLE_H
+
+#include <cstdint>
+#include <vector>
+#include "PNMHeader.h"
+#include "PixelKernels.h"
+
+using byte = unsigned char;
+
+enum class Filter {
+    Nearest,  // the closest source pixel, copied as it is
+    Bilinear, // 2x2 source pixels
+    Bicubic,  // 4x4 source pixels, Catmull-Rom
+    Box,      // the average of the source pixels a destination pixel covers, resizing only
+    Lanczos   // 6x6 source pixels, windowed sinc, resizing only
+};
+
+// Moves samples of one maxval between the stored values and linear light, both ways through tables.
+// gamma 0 - sRGB, any other - a plain power curve, the decodeGamma and encodeGamma of the dithering lab.
+class LinearLight {
+private:
+    std::vector<float> Decoded;     // linear value of every stored value
+    std::vector<double> Thresholds; // Thresholds[i] - the linear value from which i + 1 is stored instead of i
+    std::vector<uint32_t> Buckets;  // Buckets[k] - the stored value of k / BucketCount, so encode searches a few thresholds only
+    uint64_t BucketCount;
+
+public:
+    LinearLight(uint64_t maxval, double gamma);
+
+    [[nodiscard]] float decode(uint32_t value) const { return Decoded[value]; }
+
+    // the stored value whose gamma encoded form is closest to value, value is clamped to [0, 1]
+    [[nodiscard]] uint32_t encode(float value) const;
+
+    static double decodeGamma(double value, double gamma);
+
+    static double encodeGamma(double value, double gamma);
+};
+
+// A projective map of the plane on homogeneous pixel coordinates (x, y, 1), pixel centres at whole numbers.
+// The last row is 0 0 1 for affine maps: scale, shear, rotation and translation.
+struct Matrix3 {
+    double M[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+
+    // other first, then this
+    Matrix3 operator*(const Matrix3& other) const;
+
+    // false when the matrix can not be inverted
+    bool inverse(Matrix3& result) const;
+
+    // carries (x, y) through the matrix, false when it lands at infinity or behind the viewer
+    bool apply(double x, double y, double& resultX, double& resultY) const;
+
+    static Matrix3 translation(double x, double y);
+
+    // from a width x height image as it is shown to its pixels as they are stored while pending is not applied,
+    // so a warp can read them before they are moved
+    static Matrix3 orientation(const Orientation& pending, uint64_t width, uint64_t height);
+
+    // from a newWidth x newHeight canvas to the width x height image turned clockwise by degrees
+    // about the centre of both
+    static Matrix3 rotation(double degrees, uint64_t width, uint64_t height, uint64_t newWidth, uint64_t newHeight);
+};
+
+// A Matrix3 from destination to source compiled into steps along the rows: destination pixel (x, y) samples
+// the source at ((X + x * XStep + y * XRowStep) / w, (Y + x * YStep + y * YRowStep) / w)
+// with w = W + x * WStep + y * WRowStep. w stays 1 for affine maps and the division is skipped.
+struct WarpMap {
+    double X = 0, Y = 0, W = 1;
+    double XStep = 1, YStep = 0, WStep = 0;
+    double XRowStep = 0, YRowStep = 1, WRowStep = 0;
+
+    WarpMap() = default;
+
+    explicit WarpMap(const Matrix3& toSource);
+
+    [[nodiscard]] bool isAffine() const;
+
+    // Source positions of count pixels of destination row y, in a loop of its own so the compiler vectorizes it.
+    // Positions behind the viewer are sent far outside the source.
+    void row(uint64_t y, uint64_t count, double* xs, double* ys) const;
+};
+
+// The source positions of every destination pixel of a warp, worked out once for all images of one size.
+// Saved to a file it serves later runs as well: a text line "REMAP width height sourceWidth sourceHeight"
+// and then x and y of every destination pixel row after row, 32-bit little-endian floats.
+class RemapTable {
+private:
+    uint64_t Width = 0, Height = 0, SourceWidth = 0, SourceHeight = 0;
+    std::vector<float> Positions;
+
+public:
+    RemapTable() = default;
+
+    // room for a width x height destination over a sourceWidth x sourceHeight source
+    RemapTable(uint64_t width, uint64_t height, uint64_t sourceWidth, uint64_t sourceHeight);
+
+    [[nodiscard]] bool empty() const { return Positions.empty(); }
+
+    [[nodiscard]] uint64_t width() const { return Width; }
+
+    [[nodiscard]] uint64_t height() const { return Height; }
+
+    [[nodiscard]] uint64_t sourceWidth() const { return SourceWidth; }
+
+    [[nodiscard]] uint64_t sourceHeight() const { return SourceHeight; }
+
+    // works out count rows from firstRow on, bands of rows can run in parallel
+    void fill(const WarpMap& map, uint64_t firstRow, uint64_t count);
+
+    // the positions of destination row y
+    void row(uint64_t y, double* xs, double* ys) const;
+
+    void save(const char* path) const;
+
+    static RemapTable load(const char* path);
+};
+
+// the smallest canvas that holds all of width x height turned by degrees
+void rotatedSize(double degrees, uint64_t width, uint64_t height, uint64_t& newWidth, uint64_t& newHeight);
+
+// Fills a new image from an existing one through a WarpMap or a RemapTable. Bilinear and bicubic mix the pixels
+// in linear light, alpha premultiplied, and positions outside the source take the background.
+class Resampler {
+private:
+    const byte* Data;
+    uint64_t Width, Height, Channels, BytesPerSample, ColourDepth;
+    bool Alpha;
+    Filter Sampling;
+    LinearLight Light;
+    std::vector<byte> Background;       // one pixel as it is stored
+    std::vector<float> LinearBackground; // the same pixel in linear light, premultiplied
+
+public:
+    // background holds one value for every channel, in the scale of the source maxval
+    Resampler(const PNMHeader& header, const byte* data, Filter filter, double gamma,
+              const std::vector<uint32_t>& background);
+
+    // Writes count rows of the destination from firstRow on into dst, which points at its first row.
+    // Every row is newWidth pixels of the source format, bands of rows can run in parallel.
+    void rows(byte* dst, uint64_t newWidth, const WarpMap& map, uint64_t firstRow, uint64_t count) const;
+
+    // rows with the positions of table, which holds newWidth positions per row
+    void rows(byte* dst, const RemapTable& table, uint64_t firstRow, uint64_t count) const;
+};
+
+// How much each source pixel adds to each destination pixel along one axis of a resize.
+// Shrinking widens the filter by the scale, so every source pixel is counted.
+struct WeightTable {
+    uint64_t Taps = 1;           // source pixels per destination pixel
+    std::vector<uint64_t> First; // the first of them for every destination pixel
+    std::vector<float> Weights;  // Taps weights for every destination pixel, they add up to 1
+
+    WeightTable(Filter filter, uint64_t source, uint64_t destination);
+};
+
+// Resizes an image in two passes with a table of weights for each: resizeRows filters the source rows
+// into a float image newWidth x height in linear light, alpha premultiplied, then resizeColumns filters
+// its columns into the destination. Nearest copies the pixels in the second pass alone.
+class Resizer {
+private:
+    const byte* Data;
+    uint64_t Width, Height, NewWidth, NewHeight, Channels, BytesPerSample, ColourDepth;
+    bool Alpha;
+    Filter Sampling;
+    LinearLight Light;
+    WeightTable Columns, Rows;
+    std::vector<float> Between; // the result of the first pass
+
+public:
+    Resizer(const PNMHeader& header, const byte* data, uint64_t newWidth, uint64_t newHeight, Filter filter,
+            double gamma);
+
+    // the first pass for count source rows from firstRow on, bands of rows can run in parallel
+    void resizeRows(uint64_t firstRow, uint64_t count);
+
+    // The second pass, writes count destination rows from firstRow on into dst, which points at its first row.
+    // Needs the whole first pass, bands of rows can run in parallel.
+    void resizeColumns(byte* dst, uint64_t firstRow, uint64_t count) const;
+};
+
+
+#endif
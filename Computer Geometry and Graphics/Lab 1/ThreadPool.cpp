@@ -0,0 +1,139 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 1; i < threads; i++) {
+        Workers.emplace_back([this, i] { loop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(Lock);
+        Stop = true;
+    }
+    Wake.notify_all();
+    for (std::thread& worker : Workers) {
+        worker.join();
+    }
+}
+
+unsigned ThreadPool::size() const {
+    return Workers.size() + 1;
+}
+
+void ThreadPool::loop(unsigned thread) {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(Lock);
+            Wake.wait(guard, [&] { return Stop || Generation != seen; });
+            if (Stop) {
+                return;
+            }
+            seen = Generation;
+        }
+        (*Task)(thread);
+        {
+            std::lock_guard<std::mutex> guard(Lock);
+            Finished++;
+        }
+        Done.notify_one();
+    }
+}
+
+void ThreadPool::run(const std::function<void(unsigned)>& task) {
+    {
+        std::lock_guard<std::mutex> guard(Lock);
+        Task = &task;
+        Finished = 0;
+        Generation++;
+    }
+    Wake.notify_all();
+    task(0);
+    std::unique_lock<std::mutex> guard(Lock);
+    Done.wait(guard, [&] { return Finished == Workers.size(); });
+}
+
+void ThreadPool::forEach(uint64_t count, uint64_t minGrain, const std::function<void(uint64_t, uint64_t)>& job) {
+    if (count == 0) {
+        return;
+    }
+    // a few pieces per thread, so one slow piece does not hold the others up
+    uint64_t grain = std::max<uint64_t>({1, minGrain, count / (size() * 4)});
+    if (Workers.empty() || grain >= count) {
+        job(0, count);
+        return;
+    }
+    std::atomic<uint64_t> next{0};
+    run([&](unsigned) {
+        uint64_t begin;
+        while ((begin = next.fetch_add(grain)) < count) {
+            job(begin, std::min(begin + grain, count));
+        }
+    });
+}
+
+void ThreadPool::forEachStealing(uint64_t count, const std::function<void(uint64_t)>& job) {
+    if (Workers.empty() || count <= 1) {
+        for (uint64_t i = 0; i < count; i++) {
+            job(i);
+        }
+        return;
+    }
+    // the items [Begin, End) a thread still has, thieves take from End
+    struct Share {
+        std::mutex Lock;
+        uint64_t Begin = 0, End = 0;
+    };
+    unsigned threads = size();
+    std::unique_ptr<Share[]> shares(new Share[threads]);
+    for (unsigned t = 0; t < threads; t++) {
+        shares[t].Begin = count * t / threads;
+        shares[t].End = count * (t + 1) / threads;
+    }
+    run([&](unsigned self) {
+        Share& own = shares[self];
+        while (true) {
+            uint64_t item = count;
+            {
+                std::lock_guard<std::mutex> guard(own.Lock);
+                if (own.Begin < own.End) {
+                    item = own.Begin++;
+                }
+            }
+            if (item < count) {
+                job(item);
+                continue;
+            }
+            // the fullest run of another thread gives up its back half, the thread is done when none is left
+            unsigned victim = self;
+            uint64_t most = 0;
+            for (unsigned t = 0; t < threads; t++) {
+                std::lock_guard<std::mutex> guard(shares[t].Lock);
+                if (t != self && shares[t].End - shares[t].Begin > most) {
+                    most = shares[t].End - shares[t].Begin;
+                    victim = t;
+                }
+            }
+            if (most == 0) {
+                return;
+            }
+            uint64_t begin, end;
+            {
+                std::lock_guard<std::mutex> guard(shares[victim].Lock);
+                Share& other = shares[victim];
+                end = other.End;
+                begin = other.End - (other.End - other.Begin + 1) / 2;
+                other.End = begin;
+            }
+            std::lock_guard<std::mutex> guard(own.Lock);
+            own.Begin = begin;
+            own.End = end;
+        }
+    });
+}
@@ -0,0 +1,52 @@
+#ifndef LAB_1_THREADPOOL_H
+#define LAB_1_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that split one range of work at a time between them.
+// The calling thread works too, so a pool of one thread starts none.
+class ThreadPool {
+private:
+    std::vector<std::thread> Workers;
+    std::mutex Lock;
+    std::condition_variable Wake, Done;
+    const std::function<void(unsigned)>* Task = nullptr;
+    uint64_t Generation = 0;
+    unsigned Finished = 0;
+    bool Stop = false;
+
+    void loop(unsigned thread);
+
+    // calls task(thread) once on every thread, the calling one is thread 0, and returns when all are done
+    void run(const std::function<void(unsigned)>& task);
+
+public:
+    // threads 0 - one per hardware thread
+    explicit ThreadPool(unsigned threads = 1);
+
+    ThreadPool(const ThreadPool& other) = delete;
+
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+
+    ~ThreadPool();
+
+    [[nodiscard]] unsigned size() const;
+
+    // Calls job(begin, end) on pieces of [0, count) of at least minGrain each, spread over
+    // the threads, and returns when all are done. job must not throw.
+    void forEach(uint64_t count, uint64_t minGrain, const std::function<void(uint64_t, uint64_t)>& job);
+
+    // Calls job(i) once for every i of [0, count) and returns when all are done. Every thread owns an equal
+    // run of neighbouring items and takes them from the front; one that runs out steals the back half of
+    // the fullest run left, so items of very uneven cost still keep all threads busy. job must not throw.
+    void forEachStealing(uint64_t count, const std::function<void(uint64_t)>& job);
+};
+
+
+#endif
@@ -0,0 +1,204 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "PixelKernels.h"
+#include "SimdKernels.h"
+#include "Resample.h"
+
+using byte = unsigned char;
+
+// Throughput of the 90 degree rotation against image size and pixel size,
+// next to the plain row by row loop it replaced, then of inversion and mirroring
+// with the SIMD kernels next to plain loops, and last of the rotation by an angle and of halving the size with each filter.
+// Arguments format: Lab_1_benchmark [largest_side]
+
+namespace {
+    void rotateNaive(const byte* src, byte* dst, uint64_t width, uint64_t height, uint64_t pixelSize) {
+        uint64_t newWidth = height;
+        for (uint64_t i = 0; i < height; i++) {
+            for (uint64_t j = 0; j < width; j++) {
+                std::memcpy(dst + (j * newWidth + (newWidth - 1 - i)) * pixelSize, src + (i * width + j) * pixelSize, pixelSize);
+            }
+        }
+    }
+
+    void mirrorNaive(byte* data, uint64_t width, uint64_t height, uint64_t pixelSize) {
+        for (uint64_t i = 0; i < height; i++) {
+            byte* row = data + i * width * pixelSize;
+            for (uint64_t j = 0; j < width / 2; j++) {
+                for (uint64_t k = 0; k < pixelSize; k++) {
+                    std::swap(row[j * pixelSize + k], row[(width - 1 - j) * pixelSize + k]);
+                }
+            }
+        }
+    }
+
+    // megabytes of image per second, the best of a few runs
+    template<typename F>
+    double measure(uint64_t bytes, F&& rotate) {
+        double best = 0;
+        auto budget = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+        for (int run = 0; run < 3 || std::chrono::steady_clock::now() < budget; run++) {
+            auto start = std::chrono::steady_clock::now();
+            rotate();
+            std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+            best = std::max(best, bytes / time.count() / 1e6);
+            if (run >= 20) {
+                break;
+            }
+        }
+        return best;
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t largest = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4096;
+    std::cout << std::setw(12) << "size" << std::setw(8) << "pixel"
+              << std::setw(14) << "tiled MB/s" << std::setw(14) << "naive MB/s" << std::endl;
+    for (uint64_t pixelSize : {1, 3, 4, 6}) {
+        for (uint64_t side = 256; side <= largest; side *= 2) {
+            // a little off square, so the edge tiles are partial
+            uint64_t width = side + 7, height = side - 5;
+            uint64_t bytes = width * height * pixelSize;
+            std::vector<byte> src(bytes), dst(bytes);
+            for (uint64_t i = 0; i < bytes; i++) {
+                src[i] = (byte)(i * 131 + 7);
+            }
+            double tiled = measure(bytes, [&] {
+                rotatePixels(src.data(), dst.data(), width, height, pixelSize, 0);
+            });
+            std::vector<byte> check(bytes);
+            rotateNaive(src.data(), check.data(), width, height, pixelSize);
+            if (check != dst) {
+                std::cerr << "Error: tiled rotation differs at " << width << "x" << height << "!" << std::endl;
+                return 1;
+            }
+            double naive = measure(bytes, [&] {
+                rotateNaive(src.data(), dst.data(), width, height, pixelSize);
+            });
+            std::cout << std::setw(12) << (std::to_string(width) + "x" + std::to_string(height))
+                      << std::setw(8) << pixelSize << std::fixed << std::setprecision(0)
+                      << std::setw(14) << tiled << std::setw(14) << naive << std::endl;
+        }
+    }
+
+    std::cout << std::endl << "SIMD: " << simdLevel() << std::endl;
+    std::cout << std::setw(20) << "operation" << std::setw(12) << "size"
+              << std::setw(14) << "SIMD MB/s" << std::setw(14) << "naive MB/s" << std::endl;
+    uint64_t width = largest + 7, height = largest - 5;
+    for (uint64_t pixelSize : {1, 3}) {
+        uint64_t bytes = width * height * pixelSize;
+        std::vector<byte> data(bytes);
+        auto row = [&](const char* name, double fast, double naive) {
+            std::cout << std::setw(20) << name << std::setw(12) << (std::to_string(width) + "x" + std::to_string(height))
+                      << std::setw(14) << fast << std::setw(14) << naive << std::endl;
+        };
+        row(pixelSize == 1 ? "invert P5" : "invert P6",
+            measure(bytes, [&] { invertSamples(data.data(), bytes, 1, 255, pixelSize); }),
+            measure(bytes, [&] {
+                for (uint64_t i = 0; i < bytes; i++) {
+                    data[i] = 255 - data[i];
+                }
+            }));
+        row(pixelSize == 1 ? "mirror P5" : "mirror P6",
+            measure(bytes, [&] { mirrorRows(data.data(), height, width, pixelSize); }),
+            measure(bytes, [&] { mirrorNaive(data.data(), width, height, pixelSize); }));
+        row(pixelSize == 1 ? "vertical mirror P5" : "vertical mirror P6",
+            measure(bytes, [&] { mirrorColumns(data.data(), width, height, pixelSize); }),
+            measure(bytes, [&] {
+                uint64_t rowSize = width * pixelSize;
+                for (uint64_t j = 0; j < rowSize; j++) {
+                    for (uint64_t i = 0; i < height / 2; i++) {
+                        std::swap(data[i * rowSize + j], data[(height - 1 - i) * rowSize + j]);
+                    }
+                }
+            }));
+    }
+
+    std::cout << std::endl << std::setw(20) << "rotation by 7.5" << std::setw(12) << "size"
+              << std::setw(14) << "nearest MB/s" << std::setw(14) << "bilinear MB/s" << std::setw(14) << "bicubic MB/s"
+              << std::endl;
+    for (uint64_t pixelSize : {1, 3}) {
+        PNMHeader header;
+        header.Type = pixelSize == 1 ? 5 : 6;
+        header.Width = width;
+        header.Height = height;
+        header.ColourDepth = 255;
+        uint64_t bytes = width * height * pixelSize;
+        std::vector<byte> src(bytes), dst(bytes);
+        for (uint64_t i = 0; i < bytes; i++) {
+            src[i] = (byte)(i * 131 + 7);
+        }
+        WarpMap map(Matrix3::rotation(7.5, width, height, width, height));
+        std::cout << std::setw(20) << (pixelSize == 1 ? "P5" : "P6")
+                  << std::setw(12) << (std::to_string(width) + "x" + std::to_string(height));
+        for (Filter filter : {Filter::Nearest, Filter::Bilinear, Filter::Bicubic}) {
+            Resampler resampler(header, src.data(), filter, 0, std::vector<uint32_t>(pixelSize, 0));
+            std::cout << std::setw(14) << measure(bytes, [&] { resampler.rows(dst.data(), width, map, 0, height); });
+        }
+        std::cout << std::endl;
+    }
+
+    std::cout << std::endl << std::setw(20) << "projective warp" << std::setw(12) << "size"
+              << std::setw(14) << "nearest MB/s" << std::setw(14) << "table MB/s" << std::setw(14) << "bilinear MB/s"
+              << std::setw(14) << "table MB/s" << std::endl;
+    for (uint64_t pixelSize : {1, 3}) {
+        PNMHeader header;
+        header.Type = pixelSize == 1 ? 5 : 6;
+        header.Width = width;
+        header.Height = height;
+        header.ColourDepth = 255;
+        uint64_t bytes = width * height * pixelSize;
+        std::vector<byte> src(bytes), dst(bytes);
+        for (uint64_t i = 0; i < bytes; i++) {
+            src[i] = (byte)(i * 131 + 7);
+        }
+        // a keystone: the top of the destination is read from a narrower part of the source than the bottom
+        Matrix3 keystone;
+        keystone.M[0][0] = 1.2;
+        keystone.M[0][1] = 0.1;
+        keystone.M[2][1] = 0.3 / (double)height;
+        WarpMap map(keystone);
+        RemapTable table(width, height, width, height);
+        table.fill(map, 0, height);
+        std::cout << std::setw(20) << (pixelSize == 1 ? "P5" : "P6")
+                  << std::setw(12) << (std::to_string(width) + "x" + std::to_string(height));
+        for (Filter filter : {Filter::Nearest, Filter::Bilinear}) {
+            Resampler resampler(header, src.data(), filter, 0, std::vector<uint32_t>(pixelSize, 0));
+            std::cout << std::setw(14) << measure(bytes, [&] { resampler.rows(dst.data(), width, map, 0, height); })
+                      << std::setw(14) << measure(bytes, [&] { resampler.rows(dst.data(), table, 0, height); });
+        }
+        std::cout << std::endl;
+    }
+
+    std::cout << std::endl << std::setw(20) << "resize to half" << std::setw(12) << "size"
+              << std::setw(14) << "box MB/s" << std::setw(14) << "bilinear MB/s" << std::setw(14) << "lanczos MB/s"
+              << std::endl;
+    for (uint64_t pixelSize : {1, 3}) {
+        PNMHeader header;
+        header.Type = pixelSize == 1 ? 5 : 6;
+        header.Width = width;
+        header.Height = height;
+        header.ColourDepth = 255;
+        uint64_t bytes = width * height * pixelSize;
+        std::vector<byte> src(bytes), dst(bytes / 4 + pixelSize * (width + height));
+        for (uint64_t i = 0; i < bytes; i++) {
+            src[i] = (byte)(i * 131 + 7);
+        }
+        std::cout << std::setw(20) << (pixelSize == 1 ? "P5" : "P6")
+                  << std::setw(12) << (std::to_string(width) + "x" + std::to_string(height));
+        for (Filter filter : {Filter::Box, Filter::Bilinear, Filter::Lanczos}) {
+            std::cout << std::setw(14) << measure(bytes, [&] {
+                Resizer resizer(header, src.data(), width / 2, height / 2, filter, 0);
+                resizer.resizeRows(0, height);
+                resizer.resizeColumns(dst.data(), 0, height / 2);
+            });
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
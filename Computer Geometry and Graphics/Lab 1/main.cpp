@@ -4,370 +4,719 @@
 #include <vector>
 #include <string> // fix 1
 #include <cmath>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include "PixelBuffer.h"
+#include "PNMHeader.h"
+#include "PNMStream.h"
+#include "PixelKernels.h"
+#include "ThreadPool.h"
+#include "Resample.h"
+#include "ImageView.h"
 
 using byte = unsigned char;
 
+// actions 5, 6 and 8, rotation by any angle, resizing and warping
+struct ResampleOptions {
+    double Degrees = 0;                // clockwise
+    uint64_t Width = 0, Height = 0;    // the size to resize to, 0 - the one that keeps the aspect ratio
+    Filter Sampling = Filter::Bilinear;
+    double Gamma = 0;                  // the pixels are mixed in linear light, 0 - sRGB, 1 - as they are stored
+    bool Expand = false;               // grow the canvas to hold the whole image, the size is kept otherwise
+    std::vector<uint32_t> Background;  // one value for every channel, or one for all of them, black if empty
+    Matrix3 Warp;                      // from the source to the destination, pixel centres at whole numbers
+};
+
 class PNMImage {
 private:
-    std::vector<byte> Buffer;
-
     uint64_t Size, Width, Height, ColourDepth;
+    uint64_t Channels;     // 1 for P5, 3 for P6, DEPTH for P7
+    std::string TupleType; // P7 only
+    bool Alpha;            // the last channel is alpha and is left alone by Invert
     uint8_t Type;
+    Orientation Pending;   // Mirror and Rotate calls not applied to the pixels yet, Width and Height already follow them
 public:
-    std::vector<byte> ImageData;
-    static std::vector<byte> ReadBinary(const char* path, uint64_t length) {
-        std::ifstream is(path, std::ios::binary);
-        if (!is) {
-            std::cout << "Error when opening file." << std::endl;
+    PixelBuffer ImageData;
+    bool InPlace = false; // Settle moves the pixels without a second image, slower but half the memory
+    ThreadPool* Pool = nullptr; // Invert and Settle split their work over it, nullptr - this thread only
+    ResampleOptions Resampling; // what actions 5, 6 and 8 do
+    RemapTable* Remap = nullptr; // action 8 reads its positions here, an empty table is filled on first use
+    std::string RemapPath;       // where a table filled by action 8 is saved, nowhere if empty
+    Region Area;                // where actions 0, 1, 2 and 7 apply, the whole image by default
+    explicit PNMImage(PNMFrame&& frame) {
+        // one image of a multi-image file, the payload stays where the reader found it
+        Type = frame.Header.Type;
+        Width = frame.Header.Width;
+        Height = frame.Header.Height;
+        ColourDepth = frame.Header.ColourDepth;
+        Channels = frame.Header.channels();
+        TupleType = frame.Header.TupleType;
+        Alpha = frame.Header.hasAlpha();
+        Size = frame.Header.DataOffset + frame.Header.DataSize;
+        ImageData = std::move(frame.Data);
+        PrintInfo();
+    }
+    void PrintInfo() const {
+        std::cerr << "Type: P" << (int)Type << std::endl
+                  << "Size: "  << Size << " bytes" << std::endl
+                  << "Width: " << Width << "px" << std::endl
+                  << "Height: "<< Height<< "px" << std::endl
+                  << "Colour Depth: "<< ColourDepth << "bits" << std::endl;
+    }
+    [[nodiscard]] PNMHeader Header() const {
+        PNMHeader header;
+        header.Type = Type;
+        header.Width = Width;
+        header.Height = Height;
+        header.ColourDepth = ColourDepth;
+        header.Depth = Channels;
+        header.TupleType = TupleType;
+        return header;
+    }
+    void Export(PNMFrameWriter& writer) {
+        // appends this image to a multi-image output
+        Settle();
+        std::cerr << "Exporting..." << std::endl;
+        try {
+            writer.write(Header(), ImageData.data(), ImageData.size());
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            exit(1);
+        }
+
+        std::cerr << "Export Successful!" << std::endl;
+    }
+    static void Stream(const char* input, const char* output, uint64_t bandRows, const std::string& actions,
+                       ThreadPool& pool) {
+        // only chains that keep every row where it is can run band by band,
+        // the whole chain then runs on each band while it is in the cache
+        bool invert;
+        Orientation orientation;
+        Fold(actions, invert, orientation);
+        if (orientation.Transpose || orientation.FlipY || actions.find_first_of("5678") != std::string::npos) {
+            std::cerr << "Error: this action can not be streamed!" << std::endl;
             exit(1);
         }
-        std::vector<byte> data;
+        std::cerr << "Streaming..." << std::endl;
+        RowKernel kernel = [invert, orientation, &pool](const PNMHeader& header, byte* rows, uint64_t, uint64_t count) {
+            uint64_t rowSize = header.rowSize();
+            pool.forEach(count, 1, [&](uint64_t begin, uint64_t end) {
+                byte* band = rows + begin * rowSize;
+                if (invert) {
+                    invertSamples(band, (end - begin) * rowSize, header.bytesPerSample(), header.ColourDepth,
+                                  header.channels(), header.hasAlpha());
+                }
+                if (orientation.FlipX) {
+                    mirrorRows(band, end - begin, header.Width, header.channels() * header.bytesPerSample());
+                }
+            });
+        };
         try {
-            data.resize(length);
+            streamRows(input, output, bandRows, kernel);
         } catch (std::exception& e) {
-            std::cout << "Buffer error, file too large!" << std::endl;
-            std::cerr << "Error: " << e.what( ) << std::endl;
-            std::cerr << "Type " << typeid( e ).name( ) << std::endl;
-            exit (1);
+            std::cerr << e.what() << std::endl;
+            exit(1);
         }
-
+        std::cerr << "Streaming finished!" << std::endl;
+    }
+    static void Fold(const std::string& actions, bool& invert, Orientation& orientation) {
+        // inversion commutes with the moves and two of them cancel out,
+        // mirrors and rotations compose into a single orientation, actions 5 to 8 are left to Apply
+        invert = false;
+        orientation = Orientation();
+        for (char action : actions) {
+            switch (action) {
+                case '0':
+                    invert = !invert;
+                    break;
+                case '1':
+                    orientation = orientation.then(Orientation::mirror(0));
+                    break;
+                case '2':
+                    orientation = orientation.then(Orientation::mirror(1));
+                    break;
+                case '3':
+                    orientation = orientation.then(Orientation::rotate(0));
+                    break;
+                case '4':
+                    orientation = orientation.then(Orientation::rotate(1));
+                    break;
+            }
+        }
+    }
+    void Apply(const std::string& actions) {
+        // runs a chain of actions with at most one inversion pass between two resamplings,
+        // the pixels are moved once by Export or by the next resampling.
+        // With an Area inversions and mirrors are done on it in place, one by one.
+        // A crop leaves the Area alone, so the actions after it work on the whole cropped image
+        uint64_t begin = 0;
+        while (true) {
+            uint64_t end = actions.find_first_of(Area.isWhole() ? "5678" : "0125678", begin);
+            bool invert;
+            Orientation orientation;
+            Fold(actions.substr(begin, end == std::string::npos ? end : end - begin), invert, orientation);
+            if (invert) {
+                Invert();
+            }
+            Reorient(orientation);
+            if (end == std::string::npos) {
+                break;
+            }
+            switch (actions[end]) {
+                case '0':
+                    Invert(Area);
+                    break;
+                case '1':
+                case '2':
+                    Mirror(actions[end] - '1', Area);
+                    break;
+                case '5':
+                    RotateBy(Resampling);
+                    break;
+                case '6':
+                    ResizeTo(Resampling);
+                    break;
+                case '8':
+                    WarpBy(Resampling);
+                    break;
+                default:
+                    Crop(Area);
+                    Area = Region();
+                    break;
+            }
+            begin = end + 1;
+        }
+    }
+    [[nodiscard]] uint64_t PixelSize() const {
+        // channels times bytes per sample, 16-bit samples take two bytes
+        return Channels * (ColourDepth > 255 ? 2 : 1);
+    }
+    [[nodiscard]] ImageView StoredView(const Region& region) {
+        // the pixels of region as they are stored, Pending is not applied to them
+        uint64_t width = Pending.Transpose ? Height : Width;
+        uint64_t height = Pending.Transpose ? Width : Height;
+        ImageView whole(ImageData.data(), width, height, Channels, ColourDepth > 255 ? 2 : 1);
+        return whole.sub(region.stored(Pending, Width, Height));
+    }
+    void Invert(const Region& region) {
+        // a pixel does not depend on where it is, so the region is inverted where it is stored
+        if (region.isWhole()) {
+            Invert();
+            return;
+        }
+        std::cerr << "Inverting a region..." << std::endl;
+        ImageView view = StoredView(region);
+        Parallel(view.Height, 64, [&](uint64_t begin, uint64_t end) {
+            invertView(view.sub(Region{0, begin, view.Width, end - begin}), ColourDepth, Alpha);
+        });
+        std::cerr << "Inverting finished!" << std::endl;
+    }
+    void Mirror(int direction, const Region& region) {
+        // a flip of the rows of the image is a flip of the columns where it is stored transposed
+        if (region.isWhole()) {
+            Mirror(direction);
+            return;
+        }
+        std::cerr << "Mirroring a region..." << std::endl;
+        mirrorView(StoredView(region), Pending.Transpose ? 1 - direction : direction);
+        std::cerr << "Mirroring finished!" << std::endl;
+    }
+    void Crop(const Region& region) {
+        // only the pixels of the region are read, the pending orientation is kept for the smaller image
+        Region area = region.within(Width, Height);
+        ImageView view = StoredView(area);
+        std::cerr << "Cropping..." << std::endl;
+        std::vector<byte> NewImageData;
         try {
-            is.read(reinterpret_cast<char*>(data.data()), length);
+            NewImageData.resize(view.rowSize() * view.Height);
         } catch (std::exception& e) {
-            std::cout << "Reading error, file could not be read properly!" << std::endl;
+            std::cerr << "Buffer error, image too large!" << std::endl;
             std::cerr << "Error: " << e.what( ) << std::endl;
-            std::cerr << "Type " << typeid( e ).name( ) << std::endl;
-            exit (1);
+            exit(1);
         }
-
-        is.close();
-        return data;
+        copyView(view, NewImageData.data());
+        ImageData = std::move(NewImageData);
+        Width = area.Width;
+        Height = area.Height;
+        std::cerr << "Cropping finished!" << std::endl;
     }
-
-    static void WriteBinary(const char* path, const std::vector<byte>& vector) {
-        std::ofstream os(path, std::ios::binary);
-        if (!os) {
-            std::cout << "Error creating output file!" << std::endl;
+    void Invert() {
+        std::cerr << "Inverting..." << std::endl;
+        byte* data = ImageData.data();
+        uint64_t pixelSize = PixelSize();
+        Parallel(ImageData.size() / pixelSize, 1 << 14, [&](uint64_t begin, uint64_t end) {
+            invertSamples(data + begin * pixelSize, (end - begin) * pixelSize, ColourDepth > 255 ? 2 : 1, ColourDepth,
+                          Channels, Alpha);
+        });
+        std::cerr << "Inverting finished!" << std::endl;
+    }
+    void Mirror(int direction) {
+        // 0 - horizontal
+        // 1 - vertical
+        Reorient(Orientation::mirror(direction));
+    }
+    void Rotate(int direction) {
+        // 0 - clockwise
+        // 1 - counterclockwise
+        Reorient(Orientation::rotate(direction));
+    }
+    void RotateBy(const ResampleOptions& rotation) {
+        // right angles that fit the canvas are exact moves of the pixels
+        double quarters = rotation.Degrees / 90;
+        if (quarters == std::floor(quarters) && std::abs(quarters) < 1e15) {
+            auto turns = (int)(((int64_t)quarters % 4 + 4) % 4);
+            if (turns % 2 == 0 || rotation.Expand || Width == Height) {
+                for (int i = 0; i < turns; i++) {
+                    Rotate(0);
+                }
+                return;
+            }
+        }
+        std::vector<uint32_t> background = SamplingBackground(rotation, "rotations");
+        std::cerr << "Rotating..." << std::endl;
+        uint64_t newWidth = Width, newHeight = Height;
+        if (rotation.Expand) {
+            rotatedSize(rotation.Degrees, Width, Height, newWidth, newHeight);
+        }
+        // the pixels are read where they are stored, Pending is folded into the map instead of moving them first
+        Matrix3 toSource = Matrix3::orientation(Pending, Width, Height) *
+                           Matrix3::rotation(rotation.Degrees, Width, Height, newWidth, newHeight);
+        Resample(rotation, background, newWidth, newHeight, WarpMap(toSource), nullptr);
+        std::cerr << "Rotating finished!" << std::endl;
+    }
+    void WarpBy(const ResampleOptions& warp) {
+        std::vector<uint32_t> background = SamplingBackground(warp, "warps");
+        std::cerr << "Warping..." << std::endl;
+        if (Remap && !Remap->empty()) {
+            // a table of an earlier image or run, it knows the destination size
+            if (Remap->sourceWidth() != Width || Remap->sourceHeight() != Height) {
+                std::cerr << "Error: the remap table was made for another image size!" << std::endl;
+                exit(1);
+            }
+            Settle();
+            Resample(warp, background, Remap->width(), Remap->height(), WarpMap(), Remap);
+            std::cerr << "Warping finished!" << std::endl;
+            return;
+        }
+        Matrix3 forward = warp.Warp;
+        uint64_t newWidth = Width, newHeight = Height;
+        if (warp.Expand) {
+            // the box around the warped outline of the image, moved to the origin
+            double corners[4][2] = {{-0.5, -0.5}, {Width - 0.5, -0.5}, {-0.5, Height - 0.5}, {Width - 0.5, Height - 0.5}};
+            double minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+            for (auto& corner : corners) {
+                double x, y;
+                if (!forward.apply(corner[0], corner[1], x, y)) {
+                    std::cerr << "Error: the warp sends a corner of the image to infinity!" << std::endl;
+                    exit(1);
+                }
+                minX = std::min(minX, x);
+                minY = std::min(minY, y);
+                maxX = std::max(maxX, x);
+                maxY = std::max(maxY, y);
+            }
+            if (maxX - minX > (double)(1ull << 32) || maxY - minY > (double)(1ull << 32)) {
+                std::cerr << "Error: the warped image is too large!" << std::endl;
+                exit(1);
+            }
+            // a hair below a whole number is rounding noise, not another row of pixels
+            newWidth = std::max<uint64_t>(1, (uint64_t)std::ceil(maxX - minX - 1e-6));
+            newHeight = std::max<uint64_t>(1, (uint64_t)std::ceil(maxY - minY - 1e-6));
+            forward = Matrix3::translation(-0.5 - minX, -0.5 - minY) * forward;
+        }
+        Matrix3 backward;
+        if (!forward.inverse(backward)) {
+            std::cerr << "Error: the warp matrix can not be inverted!" << std::endl;
             exit(1);
         }
+        if (!Remap) {
+            Resample(warp, background, newWidth, newHeight,
+                     WarpMap(Matrix3::orientation(Pending, Width, Height) * backward), nullptr);
+            std::cerr << "Warping finished!" << std::endl;
+            return;
+        }
+        // the table is kept for images as they are shown, so it fits whatever orientation they come in
+        Settle();
         try {
-            os.write(reinterpret_cast<const char*>(&vector[0]), vector.size());
+            if (newWidth > UINT64_MAX / newHeight / 8) {
+                throw std::length_error("the remap table does not fit in memory");
+            }
+            *Remap = RemapTable(newWidth, newHeight, Width, Height);
         } catch (std::exception& e) {
-            std::cout << "Writing error, file could not be written properly!" << std::endl;
+            std::cerr << "Buffer error, image too large!" << std::endl;
             std::cerr << "Error: " << e.what( ) << std::endl;
-            std::cerr << "Type " << typeid( e ).name( ) << std::endl;
-            exit (1);
+            exit(1);
+        }
+        WarpMap map(backward);
+        Parallel(newHeight, 16, [&](uint64_t begin, uint64_t end) {
+            Remap->fill(map, begin, end - begin);
+        });
+        if (!RemapPath.empty()) {
+            Remap->save(RemapPath.c_str());
         }
+        Resample(warp, background, newWidth, newHeight, WarpMap(), Remap);
+        std::cerr << "Warping finished!" << std::endl;
     }
-
-    explicit PNMImage(const char* path) {
-        //GET FILE SIZE
-        std::error_code ec{};
-        Size = std::filesystem::file_size(path, ec);
-        if (ec != std::error_code{}) {
-            std::cout << "Error when accessing file. Message: " << ec.message() << '\n';
+    [[nodiscard]] std::vector<uint32_t> SamplingBackground(const ResampleOptions& options, const char* action) const {
+        // the background pixel of a rotation or warp, one value per channel
+        if (options.Sampling == Filter::Box || options.Sampling == Filter::Lanczos) {
+            std::cerr << "Error: " << action << " sample with filters 0 to 2 only!" << std::endl;
             exit(1);
         }
-        //READ BUFFER
-        Buffer = ReadBinary(path, Size);
-
-        //PARSE BUFFER
-        int flag = 0; // comment flag 0 - not in comment
-        // 1 - in comment
-        // 2 - in data
-        std::vector<byte> Header;
-        std::vector<int> numbers;
-        for (int i = 0; i < Buffer.size(); i++) {
-            char c = Buffer[i];
-            if (flag == 2) {
-                ImageData.push_back(c);
+        std::vector<uint32_t> background = options.Background;
+        if (background.empty()) {
+            background.assign(Channels, 0);
+        } else if (background.size() == 1) {
+            background.assign(Channels, background[0]);
+        }
+        if (background.size() != Channels) {
+            std::cerr << "Error: the background needs one value for every channel!" << std::endl;
+            exit(1);
+        }
+        for (uint32_t value : background) {
+            if (value > ColourDepth) {
+                std::cerr << "Error: the background is brighter than the maximum value!" << std::endl;
+                exit(1);
             }
-            if (flag == 0) {
-                if (c == '#' && numbers.size() < 4) {
-                    flag = 1; // in comment
-                    continue;
-                }
-                if (c == '\r' || c == '\n' || c == ' ' || c == '\0') {
-                    int32_t number = -1;
-                    int it = i - 1;
-                    while (it > 0) {
-                        if ('0' <= Buffer[it] && Buffer[it] <= '9') {
-                            if (number == -1) number++;
-                            number += (Buffer[it] - '0') * (int)pow(10, i - it - 1);
-                        }
-                        else if (Buffer[it] == '-') {
-                            std::cout << "Error: negative numbers in header!" << std::endl; // 10
-                            exit(1);
-                        }
-                        else {
-                            break;
-                        }
-                        it--;
-                    }
-                    if (number != -1)
-                        numbers.push_back(number);
-                    if (numbers.size() == 4) {
-                        flag = 2;
-                    }
-                    Header.push_back('-');
-                    continue;
-                }
-                Header.push_back(c);
+        }
+        return background;
+    }
+    void Resample(const ResampleOptions& options, const std::vector<uint32_t>& background, uint64_t newWidth,
+                  uint64_t newHeight, const WarpMap& map, const RemapTable* table) {
+        // fills a newWidth x newHeight image through map, or through table when there is one.
+        // map reads the pixels as they are stored, Pending is done with afterwards
+        uint64_t pixelSize = PixelSize();
+        std::vector<byte> NewImageData;
+        try {
+            if (newWidth > UINT64_MAX / newHeight / pixelSize) {
+                throw std::length_error("the resampled image does not fit in memory");
             }
-            if (flag == 1 && numbers.size() < 4) {
-                if (c == '\r' || c == '\n') {
-                    flag = 0;
-                }
+            NewImageData.resize(newWidth * newHeight * pixelSize);
+        } catch (std::exception& e) {
+            std::cerr << "Buffer error, image too large!" << std::endl;
+            std::cerr << "Error: " << e.what( ) << std::endl;
+            exit(1);
+        }
+        PNMHeader stored = Header();
+        if (Pending.Transpose) {
+            std::swap(stored.Width, stored.Height);
+        }
+        // each band of destination rows reads the source and writes its own rows only
+        Resampler resampler(stored, ImageData.data(), options.Sampling, options.Gamma, background);
+        byte* target = NewImageData.data();
+        Parallel(newHeight, 8, [&](uint64_t begin, uint64_t end) {
+            if (table) {
+                resampler.rows(target + begin * newWidth * pixelSize, *table, begin, end - begin);
+            } else {
+                resampler.rows(target + begin * newWidth * pixelSize, newWidth, map, begin, end - begin);
             }
+        });
+        ImageData = std::move(NewImageData);
+        Pending = Orientation();
+        Width = newWidth;
+        Height = newHeight;
+    }
+    void ResizeTo(const ResampleOptions& resize) {
+        uint64_t newWidth = resize.Width, newHeight = resize.Height;
+        if (newWidth == 0) {
+            newWidth = std::max<uint64_t>(1, std::llround((double)Width * newHeight / Height));
+        } else if (newHeight == 0) {
+            newHeight = std::max<uint64_t>(1, std::llround((double)Height * newWidth / Width));
         }
-
-        //PARSE HEADER
-        Type = numbers[0];
-        if ((Type != 5 && Type != 6) || Buffer[0] != 'P') { // fix 2, 8
-            std::cout << "Error: unable to read this file format!" << std::endl;
-            exit(1);
+        if (newWidth == Width && newHeight == Height) {
+            return;
         }
-        Width = numbers[1];
-        Height = numbers[2];
-        if (Width*Height*(Type - 4 + ((Type + 1) % 2)) != ImageData.size()) { // 11
-            std::cout << "Error: Unexpected EOF!" << std::endl; // 11
+        Settle();
+        std::cerr << "Resizing..." << std::endl;
+        uint64_t pixelSize = PixelSize();
+        std::vector<byte> NewImageData;
+        std::unique_ptr<Resizer> resizer;
+        try {
+            if (newWidth > UINT64_MAX / newHeight / pixelSize || newWidth > UINT64_MAX / Height / pixelSize) {
+                throw std::length_error("the resized image does not fit in memory");
+            }
+            NewImageData.resize(newWidth * newHeight * pixelSize);
+            resizer = std::make_unique<Resizer>(Header(), ImageData.data(), newWidth, newHeight, resize.Sampling,
+                                                resize.Gamma);
+        } catch (std::exception& e) {
+            std::cerr << "Buffer error, image too large!" << std::endl;
+            std::cerr << "Error: " << e.what( ) << std::endl;
             exit(1);
         }
-        ColourDepth = numbers[3];
-        if (ColourDepth != 255) {
-            std::cout << "Error: unable to read this file format!" << std::endl; // 10
-            exit(1);
+        // the second pass needs every row of the first, each pass splits its own rows into bands
+        Parallel(Height, 16, [&](uint64_t begin, uint64_t end) {
+            resizer->resizeRows(begin, end - begin);
+        });
+        byte* target = NewImageData.data();
+        Parallel(newHeight, 16, [&](uint64_t begin, uint64_t end) {
+            resizer->resizeColumns(target + begin * newWidth * pixelSize, begin, end - begin);
+        });
+        resizer.reset();
+        ImageData = std::move(NewImageData);
+        Width = newWidth;
+        Height = newHeight;
+        std::cerr << "Resizing finished!" << std::endl;
+    }
+    void Reorient(const Orientation& orientation) {
+        // only noted down, Settle moves the pixels once for all of them
+        Pending = Pending.then(orientation);
+        if (orientation.Transpose) {
+            std::swap(Width, Height);
         }
-
-        //OUTPUT
-        std::cout << "Type: P" << numbers[0] << std::endl
-                  << "Size: "  << Size << " bytes" << std::endl
-                  << "Width: " << Width << "px" << std::endl
-                  << "Height: "<< Height<< "px" << std::endl
-                  << "Colour Depth: "<< ColourDepth << "bits" << std::endl;
     }
-    void Export(const char* path) { // fix 3, 4: для схожести функций ввода и вывода
-        std::cout << "Exporting..." << std::endl;
-        Buffer.clear();
-
-        Buffer.push_back('P');
-        Buffer.push_back(char(Type + '0'));
-        Buffer.push_back('\n');
-
-
-        std::string Width__ = std::to_string(Width);
-        std::string Height__ = std::to_string(Height);
-        std::string ColourDepth__ = std::to_string(ColourDepth);
-
-        for (auto c : Width__) {
-            Buffer.push_back(c);
+    void Parallel(uint64_t count, uint64_t grain, const std::function<void(uint64_t, uint64_t)>& job) {
+        if (Pool) {
+            Pool->forEach(count, grain, job);
+        } else {
+            job(0, count);
         }
-
-        Buffer.push_back(' ');
-
-        for (auto c : Height__) {
-            Buffer.push_back(c);
+    }
+    void Settle() {
+        if (Pending.isIdentity()) {
+            return;
         }
+        std::cerr << "Reorienting..." << std::endl;
+        Orientation orientation = Pending;
+        Pending = Orientation();
+        uint64_t width = orientation.Transpose ? Height : Width; // as the pixels are stored
+        uint64_t height = orientation.Transpose ? Width : Height;
+        std::vector<byte> NewImageData;
+        if (orientation.Transpose && !InPlace) {
+            try {
+                NewImageData.resize(ImageData.size());
+            } catch (std::exception&) {
+                std::cerr << "Not enough memory for a second image, reorienting in place..." << std::endl;
+            }
+        }
+        byte* data = ImageData.data();
+        uint64_t pixelSize = PixelSize();
+        if (!orientation.Transpose) {
+            // pairs of rows that trade places are independent of each other
+            Parallel((height + 1) / 2, 16, [&](uint64_t begin, uint64_t end) {
+                orientRowPairs(data, width, height, pixelSize, orientation, begin, end - begin);
+            });
+        } else if (NewImageData.empty()) {
+            orientInPlace(data, width, height, pixelSize, orientation);
+        } else {
+            // bands of source rows land in different columns of the result
+            byte* target = NewImageData.data();
+            Parallel(height, 64, [&](uint64_t begin, uint64_t end) {
+                orientPixelRows(data, target, width, height, pixelSize, orientation, begin, end - begin);
+            });
+            ImageData = std::move(NewImageData);
+        }
+        std::cerr << "Reorienting finished!" << std::endl;
+    }
+};
 
-        Buffer.push_back('\n');
-
-        for (auto c : ColourDepth__) {
-            Buffer.push_back(c);
+// "0,128,255" - one or more sample values
+bool ParseValues(const char* text, std::vector<uint32_t>& values) {
+    std::string token;
+    std::istringstream list(text);
+    while (std::getline(list, token, ',')) {
+        char* end;
+        unsigned long value = std::strtoul(token.c_str(), &end, 10);
+        if (token.empty() || *end != '\0' || token[0] == '-' || value > 65535) {
+            return false;
         }
+        values.push_back(value);
+    }
+    return !values.empty();
+}
+
+// the whole of text as a finite number
+bool ParseNumber(const char* text, double& value) {
+    char* end;
+    value = std::strtod(text, &end);
+    return end != text && *end == '\0' && std::isfinite(value);
+}
 
-        Buffer.push_back('\n'); // fix 5
+// "640x480", "640x0" or "0x480" - a size, 0 keeps the aspect ratio
+bool ParseSize(const char* text, uint64_t& width, uint64_t& height) {
+    char* end;
+    width = std::strtoull(text, &end, 10);
+    if (end == text || *end != 'x' || end[1] < '0' || end[1] > '9') {
+        return false;
+    }
+    const char* rest = end + 1;
+    height = std::strtoull(rest, &end, 10);
+    return *end == '\0' && (width > 0 || height > 0) && width <= (1ull << 32) && height <= (1ull << 32);
+}
 
-        for (auto c : ImageData) {
-            Buffer.push_back(c);
+// "a,b,c,d,e,f" or "a,b,c,d,e,f,g,h,i" - a matrix row after row, the last row is 0,0,1 when left out
+bool ParseMatrix(const char* text, Matrix3& matrix) {
+    std::string token;
+    std::istringstream list(text);
+    int count = 0;
+    while (std::getline(list, token, ',')) {
+        if (count == 9 || !ParseNumber(token.c_str(), matrix.M[count / 3][count % 3])) {
+            return false;
         }
+        count++;
+    }
+    return count == 6 || count == 9;
+}
 
-        WriteBinary(path, Buffer);
+// "1,3,0" - the actions of a chain, in order
+bool ParseActions(const char* text, std::string& actions) {
+    std::string token;
+    std::istringstream list(text);
+    while (std::getline(list, token, ',')) {
+        if (token.size() != 1 || token[0] < '0' || token[0] > '8') {
+            return false;
+        }
+        actions += token[0];
+    }
+    return !actions.empty();
+}
 
-        std::cout << "Export Successful!" << std::endl;
+int main(int argc, char** argv) {
+    if (argc >= 3 && std::string(argv[1]) == "-p") { // -p <files>: report the headers, the pixels are never read
+        return probeFiles(argc - 2, argv + 2);
     }
-    void Invert() {
-        std::cout << "Inverting..." << std::endl;
-        for (auto & i : ImageData) {
-            i = ~i;
-        }
-        std::cout << "Inverting finished!" << std::endl;
+    if (argc < 4) { // 10
+        std::cerr << "Error: not enough arguments!" << std::endl; // 11
+        exit(1);
     }
-    void Mirror(int direction) {
-        // 0 - horizontal
-        // 1 - vertical
-        if (direction == 0) {
-            std::cout << "Mirroring horizontally..." << std::endl;
-            if (Type == 5) {
-                uint64_t i,j;
-                for (i = 0; i < Height; i++) {
-                    for (j = 0; j < Width/2; j++) {
-                        std::swap(ImageData[i*Width + j], ImageData[i*Width + Width - 1 - j]);
-                    }
-                }
-            } else {
-                uint64_t i,j;
-                for (i = 0; i < Height; i++) {
-                    for (j = 0; j < Width*3/2; j+=3) {
-                        std::swap(ImageData[i*Width*3 + j], ImageData[i*Width*3 + Width*3 - j - 3]);
-                        std::swap(ImageData[i*Width*3 + j + 1], ImageData[i*Width*3 + Width*3 - j - 2]);
-                        std::swap(ImageData[i*Width*3 + j + 2], ImageData[i*Width*3 + Width*3 - j - 1]);
-                    }
-                }
+    std::string actions;
+    if (!ParseActions(argv[3], actions)) { // 10
+        std::cerr << "Error: invalid command!" << std::endl;
+        exit(1);
+    }
+
+    uint64_t bandRows = 0; // -s <rows>: stream the image this many rows at a time
+    bool atomic = false;   // -a: write a temporary file and rename it over the output
+    bool inPlace = false;  // -i: rotate without a second copy of the image
+    unsigned threads = 1;  // -j <threads>: split the work over this many threads, 0 - one per core
+    ResampleOptions resampling; // -r <degrees>, -z <size>, -m <matrix>, -f <filter>, -g <gamma>, -b <values>, -e:
+                                // what actions 5, 6 and 8 do
+    bool hasAngle = false, hasSize = false, hasMatrix = false;
+    std::string remapPath;      // -t <file>: the remap table of action 8, read when the file exists, written otherwise
+    Region area;           // -c <x,y,width,height>: where actions 0, 1, 2 and 7 apply
+    for (int i = 4; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "-s" && i + 1 < argc) {
+            bandRows = std::strtoull(argv[++i], nullptr, 10);
+            if (bandRows == 0) {
+                std::cerr << "Error: invalid band size!" << std::endl;
+                exit(1);
             }
-            std::cout << "Mirroring finished!" << std::endl;
-        }
-        if (direction == 1) {
-            std::cout << "Mirroring vertically..." << std::endl;
-            if (Type == 5) {
-                uint64_t i,j;
-                for (i = 0; i < Width; i++) {
-                    for (j = 0; j < Height/2; j++) {
-                        std::swap(ImageData[j * Width + i], ImageData[(Height - 1 - j) * Width + i]);
-                    }
-                }
-            } else {
-                uint64_t i,j;
-                for (i = 0; i < Width*3; i++) {
-                    for (j = 0; j < Height/2; j++) {
-                        std::swap(ImageData[j * Width*3 + i], ImageData[(Height - 1 - j) * Width*3 + i]);
-                    }
-                }
+        } else if (option == "-a") {
+            atomic = true;
+        } else if (option == "-i") {
+            inPlace = true;
+        } else if (option == "-j" && i + 1 < argc) {
+            char* end;
+            threads = std::strtoul(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i]) {
+                std::cerr << "Error: invalid thread count!" << std::endl;
+                exit(1);
             }
-            std::cout << "Mirroring finished!" << std::endl;
-        }
-    }
-    void Rotate(int direction) {
-        // 0 - clockwise
-        // 1 - counterclockwise
-        if (direction == 0) {
-            std::cout << "Rotating clockwise..." << std::endl;
-            if (Type == 5) {
-                std::vector<byte> NewImageData;
-                uint64_t NewWidth, NewHeight;
-                NewHeight = Width;
-                NewWidth = Height;
-                try {
-                    NewImageData.resize(Width * Height);
-                } catch (std::exception& e) {
-                    std::cout << "Memory error during rotation!" << std::endl;
-                    std::cerr << "Error: " << e.what( ) << std::endl;
-                    std::cerr << "Type " << typeid( e ).name( ) << std::endl;
-                    exit (1);
-                }
-                for (uint64_t i = 0; i < Height; i++) {
-                    for (uint64_t j = 0; j < Width; j++) {
-                        NewImageData[(NewWidth - i - 1) + j*NewWidth] = ImageData[i*Width + j];
-                    }
-                }
-                Width = NewWidth;
-                Height = NewHeight;
-                ImageData = NewImageData;
-            } else {
-                std::vector<byte> NewImageData;
-                uint64_t NewWidth, NewHeight;
-                NewHeight = Width;
-                NewWidth = Height;
-                try {
-                    NewImageData.resize(Width * Height * 3);
-                } catch (std::exception& e) {
-                    std::cout << "Memory error during rotation!" << std::endl;
-                    std::cerr << "Error: " << e.what( ) << std::endl;
-                    std::cerr << "Type " << typeid( e ).name( ) << std::endl;
-                    exit (1);
-                }
-                for (uint64_t i = 0; i < Height; i++) {
-                    for (uint64_t j = 0; j < Width; j++) {
-                        NewImageData[(NewWidth - i - 1)*3 + j*NewWidth*3] = ImageData[j*3 + Width*3*i];
-                        NewImageData[(NewWidth - i - 1)*3 + j*NewWidth*3 + 1] = ImageData[j*3 + Width*3*i + 1];
-                        NewImageData[(NewWidth - i - 1)*3 + j*NewWidth*3 + 2] = ImageData[j*3 + Width*3*i + 2];
-                    }
-                }
-                Width = NewWidth;
-                Height = NewHeight;
-                ImageData = NewImageData;
+        } else if (option == "-r" && i + 1 < argc) {
+            if (!ParseNumber(argv[++i], resampling.Degrees)) {
+                std::cerr << "Error: invalid angle!" << std::endl;
+                exit(1);
             }
-            std::cout << "Rotating finished!" << std::endl;
-        }
-        if (direction == 1) {
-            std::cout << "Rotating counterclockwise..." << std::endl;
-            if (Type == 5) {
-                std::vector<byte> NewImageData;
-                uint64_t NewWidth, NewHeight;
-                NewHeight = Width;
-                NewWidth = Height;
-                try {
-                    NewImageData.resize(Width * Height);
-                } catch (std::exception& e) {
-                    std::cout << "Memory error during rotation!" << std::endl;
-                    std::cerr << "Error: " << e.what( ) << std::endl;
-                    std::cerr << "Type " << typeid( e ).name( ) << std::endl;
-                    exit (1);
-                }
-                for (uint64_t i = 0; i < Height; i++) {
-                    for (uint64_t j = 0; j < Width; j++) {
-                        NewImageData[j*NewWidth + i] = ImageData[(i + 1)*Width - 1 - j];
-                    }
-                }
-                Width = NewWidth;
-                Height = NewHeight;
-                ImageData = NewImageData;
-            } else {
-                std::vector<byte> NewImageData;
-                uint64_t NewWidth, NewHeight;
-                NewHeight = Width;
-                NewWidth = Height;
-                try {
-                    NewImageData.resize(Width * Height * 3);
-                } catch (std::exception& e) {
-                    std::cout << "Memory error during rotation!" << std::endl;
-                    std::cerr << "Error: " << e.what( ) << std::endl;
-                    std::cerr << "Type " << typeid( e ).name( ) << std::endl;
-                    exit (1);
-                }
-                for (uint64_t i = 0; i < Height; i++) {
-                    for (uint64_t j = 0; j < Width; j++) {
-                        NewImageData[(NewHeight - 1 - j)*NewWidth*3 + i*3] = ImageData[i*Width*3 + j*3];
-                        NewImageData[(NewHeight - 1 - j)*NewWidth*3 + i*3 + 1] = ImageData[i*Width*3 + j*3 + 1];
-                        NewImageData[(NewHeight - 1 - j)*NewWidth*3 + i*3 + 2] = ImageData[i*Width*3 + j*3 + 2];
-                    }
-                }
-                Width = NewWidth;
-                Height = NewHeight;
-                ImageData = NewImageData;
+            hasAngle = true;
+        } else if (option == "-z" && i + 1 < argc) {
+            if (!ParseSize(argv[++i], resampling.Width, resampling.Height)) {
+                std::cerr << "Error: invalid size!" << std::endl;
+                exit(1);
+            }
+            hasSize = true;
+        } else if (option == "-m" && i + 1 < argc) {
+            if (!ParseMatrix(argv[++i], resampling.Warp)) {
+                std::cerr << "Error: invalid matrix!" << std::endl;
+                exit(1);
             }
-            std::cout << "Rotating finished!" << std::endl;
+            hasMatrix = true;
+        } else if (option == "-t" && i + 1 < argc) {
+            remapPath = argv[++i];
+        } else if (option == "-f" && i + 1 < argc) {
+            std::string filter = argv[++i];
+            const Filter filters[] = {Filter::Nearest, Filter::Bilinear, Filter::Bicubic, Filter::Box, Filter::Lanczos};
+            if (filter.size() != 1 || filter[0] < '0' || filter[0] > '4') {
+                std::cerr << "Error: invalid filter!" << std::endl;
+                exit(1);
+            }
+            resampling.Sampling = filters[filter[0] - '0'];
+        } else if (option == "-g" && i + 1 < argc) {
+            if (!ParseNumber(argv[++i], resampling.Gamma) || resampling.Gamma < 0) {
+                std::cerr << "Error: invalid gamma!" << std::endl;
+                exit(1);
+            }
+        } else if (option == "-b" && i + 1 < argc) {
+            if (!ParseValues(argv[++i], resampling.Background)) {
+                std::cerr << "Error: invalid background!" << std::endl;
+                exit(1);
+            }
+        } else if (option == "-c" && i + 1 < argc) {
+            if (!Region::parse(argv[++i], area) || area.isWhole()) {
+                std::cerr << "Error: invalid region!" << std::endl;
+                exit(1);
+            }
+        } else if (option == "-e") {
+            resampling.Expand = true;
+        } else {
+            // an unknown option, or a known one without its value
+            std::cerr << "Incorrect arguments" << std::endl;
+            exit(1);
         }
     }
-};
-
-int main(int argc, char** argv) {
-    if (argc < 4) { // 10
-        std::cout << "Error: not enough arguments!" << std::endl; // 11
+    if (actions.find('5') != std::string::npos && !hasAngle) {
+        std::cerr << "Error: action 5 needs an angle, -r <degrees>!" << std::endl;
+        exit(1);
+    }
+    if (actions.find('6') != std::string::npos && !hasSize) {
+        std::cerr << "Error: action 6 needs a size, -z <width>x<height>!" << std::endl;
         exit(1);
     }
-    if (argv[3][0] < '0' || argv[3][0] > '4') { // 10
-        std::cout << "Error: invalid command!" << std::endl;
+    if (actions.find('8') != std::string::npos && !hasMatrix && (remapPath.empty() || !std::filesystem::exists(remapPath))) {
+        std::cerr << "Error: action 8 needs a matrix, -m <a,b,c,d,e,f>, or an existing remap table, -t <file>!" << std::endl;
         exit(1);
     }
+    if (actions.find('7') != std::string::npos && area.isWhole()) {
+        std::cerr << "Error: action 7 needs a region, -c <x,y,width,height>!" << std::endl;
+        exit(1);
+    }
+    ThreadPool pool(threads);
+    if (bandRows > 0) {
+        if (!area.isWhole()) {
+            std::cerr << "Error: a region can not be streamed!" << std::endl;
+            exit(1);
+        }
+        PNMImage::Stream(argv[1], argv[2], bandRows, actions, pool);
+        return 0;
+    }
 
-    PNMImage image(argv[1]);
-    switch (argv[3][0]) {
-        case '0':
-            image.Invert();
-            break;
-        case '1':
-            image.Mirror(0);
-            break;
-        case '2':
-            image.Mirror(1);
-            break;
-        case '3':
-            image.Rotate(0);
-            break;
-        case '4':
-            image.Rotate(1);
-            break;
-    }
-    image.Export(argv[2]);
+    // every image of a multi-image file is processed in turn and written in the same order
+    try {
+        // the table is worked out by the first image that warps and used by the rest
+        RemapTable remap;
+        if (!remapPath.empty() && std::filesystem::exists(remapPath)) {
+            remap = RemapTable::load(remapPath.c_str());
+        }
+        PNMFrameReader frames(argv[1]);
+        PNMFrameWriter writer(argv[2], atomic || frames.isSource(argv[2]));
+        PNMFrame frame;
+        while (frames.next(frame)) {
+            PNMImage image(std::move(frame));
+            image.InPlace = inPlace;
+            image.Pool = &pool;
+            image.Resampling = resampling;
+            image.Area = area;
+            if (!remapPath.empty()) {
+                image.Remap = &remap;
+                image.RemapPath = remapPath;
+            }
+            image.Apply(actions); // the whole chain runs in memory, one load and one export per image
+            image.Export(writer);
+        }
+        writer.finish();
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        exit(1);
+    }
     return 0;
 }
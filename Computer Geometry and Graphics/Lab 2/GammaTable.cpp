@@ -0,0 +1,79 @@
+#include "GammaTable.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace {
+    uint64_t bitsOf(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof bits);
+        return bits;
+    }
+
+    double valueOf(uint64_t bits) {
+        double value;
+        std::memcpy(&value, &bits, sizeof value);
+        return value;
+    }
+}
+
+GammaTable::GammaTable(double gamma, uint64_t maxval)
+        : Maxval(maxval), Decoded(maxval > 255 ? 65536 : 256), Encoded(Decoded.size()), Thresholds(maxval) {
+    double full = (double)Decoded.size() - 1;
+    for (uint64_t i = 0; i < Decoded.size(); i++) {
+        Decoded[i] = decodeGamma((double)i / maxval, gamma);
+        Encoded[i] = encodeGamma(i / full, gamma) * maxval;
+    }
+    // The threshold of i is found among the bit patterns of the doubles around decodeGamma(i / maxval),
+    // which order like the values they stand for. Searching against the formula itself keeps pow's rounding
+    auto reaches = [&](double linear, uint64_t i) {
+        return (uint64_t)(maxval * encodeGamma(linear, gamma)) >= i;
+    };
+    for (uint64_t i = 1; i <= maxval; i++) {
+        uint64_t guess = bitsOf(std::min(std::max(decodeGamma((double)i / maxval, gamma), 0.0), 1.0));
+        uint64_t low = guess > 16 ? guess - 16 : 0, high = guess + 16;
+        if (reaches(valueOf(low), i) || !reaches(valueOf(high), i)) {
+            low = 0;
+            high = bitsOf(2.0);
+        }
+        while (high - low > 1) {
+            uint64_t middle = low + (high - low) / 2;
+            (reaches(valueOf(middle), i) ? high : low) = middle;
+        }
+        Thresholds[i - 1] = valueOf(high);
+    }
+}
+
+const GammaTable& GammaTable::get(double gamma, uint64_t maxval) {
+    static std::mutex lock;
+    static std::map<std::pair<double, uint64_t>, std::unique_ptr<GammaTable>> tables;
+    std::lock_guard<std::mutex> guard(lock);
+    auto& table = tables[{gamma, maxval}];
+    if (!table) {
+        table.reset(new GammaTable(gamma, maxval));
+    }
+    return *table;
+}
+
+uint32_t GammaTable::encode(double linear) const {
+    // upper_bound over Thresholds with a fixed number of steps and no branches to mispredict, so the searches
+    // of the channels of one pixel overlap
+    const double* base = Thresholds.data();
+    for (uint64_t count = Thresholds.size(); count > 1; count -= count / 2) {
+        base = base[count / 2 - 1] <= linear ? base + count / 2 : base;
+    }
+    return (uint32_t)(base - Thresholds.data()) + (*base <= linear);
+}
+
+double GammaTable::decodeGamma(double value, double gamma) {
+    return gamma == 0 ? value <= 0.04045 ? value / 12.92 : pow((value + 0.055) / 1.055, 2.4) : pow(value, gamma);
+}
+
+double GammaTable::encodeGamma(double value, double gamma) {
+    return gamma == 0 ? value <= 0.0031308 ? 12.92 * value : 1.055 * pow(value, 1 / 2.4) - 0.055 : pow(value,
+                                                                                                       1.0 / gamma);
+}
@@ -0,0 +1,88 @@
+#include "ImageView.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sstream>
+
+bool Region::isWhole() const {
+    return X == 0 && Y == 0 && Width == 0 && Height == 0;
+}
+
+Region Region::within(uint64_t width, uint64_t height) const {
+    if (X >= width || Y >= height) {
+        throw std::runtime_error("Error: the region does not fit in the image!");
+    }
+    Region result{X, Y, Width == 0 ? width - X : Width, Height == 0 ? height - Y : Height};
+    if (result.Width > width - X || result.Height > height - Y) {
+        throw std::runtime_error("Error: the region does not fit in the image!");
+    }
+    return result;
+}
+
+Region Region::stored(const Orientation& pending, uint64_t width, uint64_t height) const {
+    // undo the flips on the oriented image, then the transpose swaps the axes
+    Region region = within(width, height);
+    if (pending.FlipX) {
+        region.X = width - region.X - region.Width;
+    }
+    if (pending.FlipY) {
+        region.Y = height - region.Y - region.Height;
+    }
+    if (pending.Transpose) {
+        std::swap(region.X, region.Y);
+        std::swap(region.Width, region.Height);
+    }
+    return region;
+}
+
+bool Region::parse(const char* text, Region& region) {
+    uint64_t* fields[] = {&region.X, &region.Y, &region.Width, &region.Height};
+    std::string token;
+    std::istringstream list(text);
+    int count = 0;
+    while (std::getline(list, token, ',')) {
+        if (count == 4 || token.empty() || token.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        *fields[count++] = std::strtoull(token.c_str(), nullptr, 10);
+    }
+    return count == 4;
+}
+
+ImageView::ImageView(byte* data, uint64_t width, uint64_t height, uint64_t channels, uint64_t bytesPerSample)
+        : Data(data), Width(width), Height(height), Stride(width * channels * bytesPerSample), Channels(channels),
+          BytesPerSample(bytesPerSample) {}
+
+ImageView ImageView::sub(const Region& region) const {
+    Region area = region.within(Width, Height);
+    ImageView view = *this;
+    view.Data = Data + area.Y * Stride + area.X * pixelSize();
+    view.Width = area.Width;
+    view.Height = area.Height;
+    return view;
+}
+
+void invertView(const ImageView& view, uint64_t maxval, bool alpha) {
+    view.forEachRun([&](byte* rows, uint64_t, uint64_t count) {
+        invertSamples(rows, count * view.rowSize(), view.BytesPerSample, maxval, view.Channels, alpha);
+    });
+}
+
+void mirrorView(const ImageView& view, int direction) {
+    if (direction == 0) {
+        view.forEachRun([&](byte* rows, uint64_t, uint64_t count) {
+            mirrorRows(rows, count, view.Width, view.pixelSize());
+        });
+        return;
+    }
+    for (uint64_t i = 0; i < view.Height / 2; i++) {
+        std::swap_ranges(view.row(i), view.row(i) + view.rowSize(), view.row(view.Height - 1 - i));
+    }
+}
+
+void copyView(const ImageView& view, byte* dst) {
+    view.forEachRun([&](byte* rows, uint64_t firstRow, uint64_t count) {
+        std::memcpy(dst + firstRow * view.rowSize(), rows, count * view.rowSize());
+    });
+}
@@ -0,0 +1,80 @@
+#ifndef LAB_1_IMAGEVIEW_H
+#define LAB_1_IMAGEVIEW_H
+
+#include <cstdint>
+#include "PixelKernels.h"
+
+using byte = unsigned char;
+
+// A rectangle of an image given by its top left corner and size.
+// Width or Height 0 reach to the right or bottom edge, so Region() is the whole image.
+struct Region {
+    uint64_t X = 0, Y = 0, Width = 0, Height = 0;
+
+    [[nodiscard]] bool isWhole() const;
+
+    // this region of a width x height image with the sizes filled in, throws when it does not fit
+    [[nodiscard]] Region within(uint64_t width, uint64_t height) const;
+
+    // Where this region of a width x height image lies in its pixels as they are stored, while pending
+    // is not applied to them yet. The pixels there are in the stored order, transposed and flipped.
+    [[nodiscard]] Region stored(const Orientation& pending, uint64_t width, uint64_t height) const;
+
+    // "x,y,width,height", false when text is not four numbers
+    static bool parse(const char* text, Region& region);
+};
+
+// The pixels of a rectangle inside an image, row by row with Stride bytes from one row to the next.
+// Nothing is copied, the image must outlive the view.
+struct ImageView {
+    byte* Data = nullptr; // the top left pixel
+    uint64_t Width = 0, Height = 0;
+    uint64_t Stride = 0;
+    uint64_t Channels = 1;
+    uint64_t BytesPerSample = 1;
+
+    ImageView() = default;
+
+    // a whole image of width x height stored row after row
+    ImageView(byte* data, uint64_t width, uint64_t height, uint64_t channels, uint64_t bytesPerSample);
+
+    [[nodiscard]] uint64_t pixelSize() const { return Channels * BytesPerSample; }
+
+    // bytes of pixels in one row, Stride may be more
+    [[nodiscard]] uint64_t rowSize() const { return Width * pixelSize(); }
+
+    [[nodiscard]] byte* row(uint64_t i) const { return Data + i * Stride; }
+
+    // the rows follow each other with no gap, as in a whole image or a band of whole rows
+    [[nodiscard]] bool isContiguous() const { return Stride == rowSize() || Height <= 1; }
+
+    // the part of this view that region covers, throws when it does not fit
+    [[nodiscard]] ImageView sub(const Region& region) const;
+
+    // Calls f(rows, firstRow, count) on runs of rows stored back to back,
+    // once for the whole view when it is contiguous and once per row otherwise.
+    template<typename F>
+    void forEachRun(F&& f) const {
+        if (isContiguous()) {
+            if (Height > 0) {
+                f(Data, (uint64_t)0, Height);
+            }
+            return;
+        }
+        for (uint64_t i = 0; i < Height; i++) {
+            f(row(i), i, (uint64_t)1);
+        }
+    }
+};
+
+// maxval - value for every sample of the view, with alpha the last channel is kept
+void invertView(const ImageView& view, uint64_t maxval, bool alpha);
+
+// reverses the pixels of the view, 0 - the order within each row, 1 - the order of the rows
+void mirrorView(const ImageView& view, int direction);
+
+// copies the pixels of the view into dst row after row, dst holds Width * Height pixels
+void copyView(const ImageView& view, byte* dst);
+
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef LAB_1_PNMHEADER_H
+#define LAB_1_PNMHEADER_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+using byte = unsigned char;
+
+// Header of a binary PNM or PAM image and where its payload lives in the file.
+struct PNMHeader {
+    uint8_t Type = 0;
+    uint64_t Width = 0, Height = 0, ColourDepth = 0;
+    uint64_t Depth = 0;      // channels of a P7 image, 1 to 4
+    std::string TupleType;   // TUPLTYPE of a P7 image, may be empty
+    uint64_t DataOffset = 0; // first byte of the payload
+    uint64_t DataSize = 0;   // payload length the header promises
+
+    [[nodiscard]] uint64_t channels() const;
+
+    // the last channel is alpha (GRAYSCALE_ALPHA, RGB_ALPHA)
+    [[nodiscard]] bool hasAlpha() const;
+
+    [[nodiscard]] uint64_t bytesPerSample() const;
+
+    [[nodiscard]] uint64_t rowSize() const;
+
+    // Header text as Export writes it: "P5\n<width> <height>\n<maxval>\n",
+    // or the WIDTH ... ENDHDR block for P7.
+    [[nodiscard]] std::string format() const;
+
+    // Reads the header from the front of data, stops right after the whitespace
+    // that ends it. Never looks at the payload.
+    static PNMHeader parse(const byte* data, uint64_t size);
+
+    // Same, but pulls the header off a stream and leaves it at the first payload byte.
+    static PNMHeader read(std::istream& is);
+};
+
+
+#endif
@@ -3,6 +3,10 @@
 //
 
 #include "PNMImage.h"
+#include "PNMHeader.h"
+#include "PNMStream.h"
+#include "PixelKernels.h"
+#include "GammaTable.h"
 #include <iostream>
 #include <fstream>
 #include <algorithm>
@@ -11,428 +15,389 @@
 #include <vector>
 #include <cmath>
 #include <exception>
+#include <cstring>
+#include <memory>
 
-const double EPS = 1e-5;
+const double EPS = 1e-9;
 
-std::vector<byte> PNMImage::ReadBinary(const char* path, uint64_t length) {
-    std::ifstream is(path, std::ios::binary);
-    if (!is) {
-        throw std::runtime_error("Error when opening file.");
-    }
-    std::vector<byte> data;
-    try {
-        data.resize(length);
-    } catch (std::exception& e) {
-        char* error = nullptr;
-        strcat(error, "Buffer error, file too large!\n");
-        strcat(error, e.what());
-        throw std::runtime_error(error);
-    }
-
-    try {
-        is.read(reinterpret_cast<char*>(data.data()), length);
-    } catch (std::exception& e) {
-        char* error = nullptr;
-        strcat(error, "Reading error, file could not be read properly!\n");
-        strcat(error, e.what());
-        throw std::runtime_error(error);
-    }
-    is.close();
-    return data;
-}
-
-void PNMImage::WriteBinary(const char* path, const std::vector<byte>& vector) {
-    std::ofstream os(path, std::ios::binary);
-    if (!os) {
-        throw std::runtime_error("Error creating output file!");
-    }
-    try {
-        os.write(reinterpret_cast<const char*>(&vector[0]), vector.size());
-    } catch (std::exception& e) {
-        char* error = nullptr;
-        strcat(error, "Writing error, file could not be written properly!\n");
-        strcat(error, e.what());
-        throw std::runtime_error(error);
-    }
-    os.flush();
-    os.close();
-}
-
-PNMImage::PNMImage(const char* path) {
-    //GET FILE SIZE
-    std::error_code ec{};
-    Size = std::filesystem::file_size(path, ec);
-    if (ec != std::error_code{}) {
-        throw std::runtime_error("Error when accessing file.");
-    }
-    //READ BUFFER
-    Buffer = ReadBinary(path, Size);
-
-    //PARSE BUFFER
-    int flag = 0; // comment flag 0 - not in comment
-    // 1 - in comment
-    // 2 - in data
-    std::vector<byte> Header;
-    std::vector<int> numbers;
-    for (int i = 0; i < Buffer.size(); i++) {
-        char c = Buffer[i];
-        if (flag == 2) {
-            ImageData.push_back(c);
-        }
-        if (flag == 0) {
-            if (c == '#' && numbers.size() < 4) {
-                flag = 1; // in comment
+namespace {
+    // Liang-Barsky: the part [first, last] of the segment from (x0, y0) to (x1, y1) inside the box,
+    // first and last are narrowed from what they hold. False when no part is inside
+    bool clipSegment(double x0, double y0, double x1, double y1, double left, double top, double right,
+                     double bottom, double& first, double& last) {
+        double dx = x1 - x0, dy = y1 - y0;
+        // each side of the box as p * t <= q
+        double p[4] = {-dx, dx, -dy, dy};
+        double q[4] = {x0 - left, right - x0, y0 - top, bottom - y0};
+        for (int i = 0; i < 4; i++) {
+            if (p[i] == 0) {
+                if (q[i] < 0)
+                    return false; // parallel to the side and outside it
                 continue;
             }
-            if (c == '\r' || c == '\n' || c == ' ' || c == '\0') {
-                int32_t number = -1;
-                int it = i - 1;
-                while (it > 0) {
-                    if ('0' <= Buffer[it] && Buffer[it] <= '9') {
-                        if (number == -1) number++;
-                        number += (Buffer[it] - '0') * (int)pow(10, i - it - 1);
-                    }
-                    else if (Buffer[it] == '-') {
-                        throw std::runtime_error("Error: negative numbers in header!");
-                    }
-                    else {
-                        break;
-                    }
-                    it--;
-                }
-                if (number != -1)
-                    numbers.push_back(number);
-                if (numbers.size() == 4) {
-                    flag = 2;
-                }
-                Header.push_back('-');
-                continue;
-            }
-            Header.push_back(c);
-        }
-        if (flag == 1 && numbers.size() < 4) {
-            if (c == '\r' || c == '\n') {
-                flag = 0;
+            double t = q[i] / p[i];
+            if (p[i] < 0) {
+                first = std::max(first, t);
+            } else {
+                last = std::min(last, t);
             }
         }
+        return first <= last;
     }
 
-    //PARSE HEADER
-    Type = numbers[0];
-    if ((Type != 5 && Type != 6) || Buffer[0] != 'P') {
-        throw std::runtime_error("Error: unable to read this file format!");
-    }
-    Width = numbers[1];
-    Height = numbers[2];
-    if (Width*Height*(Type - 4 + ((Type + 1) % 2)) != ImageData.size()) {
-        throw std::runtime_error("Error: Unexpected EOF!");
-    }
-    ColourDepth = numbers[3];
-    if (ColourDepth != 255) {
-        throw std::runtime_error("Error: unable to read this file format!");
+    // the least and greatest x of the convex quad within the strip top <= y <= bottom, false when it misses the strip
+    template<typename Point>
+    bool rowSpan(const Point (&quad)[4], double top, double bottom, double& left, double& right) {
+        left = INFINITY;
+        right = -INFINITY;
+        for (int i = 0; i < 4; i++) {
+            const Point& u = quad[i];
+            const Point& v = quad[(i + 1) % 4];
+            double first = 0, last = 1;
+            // the edge is clipped to the strip, its ends there bound the quad
+            if (!clipSegment(u.x, u.y, v.x, v.y, -INFINITY, top, INFINITY, bottom, first, last))
+                continue;
+            for (double t : {first, last}) {
+                double x = u.x + t * (v.x - u.x);
+                left = std::min(left, x);
+                right = std::max(right, x);
+            }
+        }
+        return left <= right;
     }
 }
 
-void PNMImage::Export(const char* path) {
-    Buffer.clear();
-
-    Buffer.push_back('P');
-    Buffer.push_back(char(Type + '0'));
-    Buffer.push_back('\n');
-
-
-    std::string Width__ = std::to_string(Width);
-    std::string Height__ = std::to_string(Height);
-    std::string ColourDepth__ = std::to_string(ColourDepth);
-
-    for (auto c : Width__) {
-        Buffer.push_back(c);
-    }
-
-    Buffer.push_back(' ');
-
-    for (auto c : Height__) {
-        Buffer.push_back(c);
-    }
-
-    Buffer.push_back('\n');
-
-    for (auto c : ColourDepth__) {
-        Buffer.push_back(c);
-    }
-
-    Buffer.push_back('\n'); // fix 5 for mac ' '
+PNMImage::PNMImage(PNMFrame&& frame) {
+    Type = frame.Header.Type;
+    Width = frame.Header.Width;
+    Height = frame.Header.Height;
+    ColourDepth = frame.Header.ColourDepth;
+    Channels = frame.Header.channels();
+    TupleType = frame.Header.TupleType;
+    Alpha = frame.Header.hasAlpha();
+    Size = frame.Header.DataOffset + frame.Header.DataSize;
+    ImageData = std::move(frame.Data);
+}
 
-    for (auto c : ImageData) {
-        Buffer.push_back(c);
-    }
+PNMHeader PNMImage::header() const {
+    PNMHeader header;
+    header.Type = Type;
+    header.Width = Width;
+    header.Height = Height;
+    header.ColourDepth = ColourDepth;
+    header.Depth = Channels;
+    header.TupleType = TupleType;
+    return header;
+}
 
-    WriteBinary(path, Buffer);
+void PNMImage::Export(PNMFrameWriter& writer) {
+    settle();
+    writer.write(header(), ImageData.data(), ImageData.size());
 }
 
 void PNMImage::Invert() {
-    for (auto & i : ImageData) {
-        i = ~i;
-    }
+    invertSamples(ImageData.data(), ImageData.size(), bytesPerSample(), ColourDepth, Channels, Alpha);
 }
 
 void PNMImage::Mirror(int direction) {
     // 0 - horizontal
     // 1 - vertical
-    if (direction == 0) {
-        if (Type == 5) {
-            uint64_t i,j;
-            for (i = 0; i < Height; i++) {
-                for (j = 0; j < Width/2; j++) {
-                    std::swap(ImageData[i*Width + j], ImageData[i*Width + Width - 1 - j]);
-                }
-            }
-        } else {
-            uint64_t i,j;
-            for (i = 0; i < Height; i++) {
-                for (j = 0; j < Width*3/2; j+=3) {
-                    std::swap(ImageData[i*Width*3 + j], ImageData[i*Width*3 + Width*3 - j - 3]);
-                    std::swap(ImageData[i*Width*3 + j + 1], ImageData[i*Width*3 + Width*3 - j - 2]);
-                    std::swap(ImageData[i*Width*3 + j + 2], ImageData[i*Width*3 + Width*3 - j - 1]);
-                }
-            }
-        }
-    }
-    if (direction == 1) {
-        if (Type == 5) {
-            uint64_t i,j;
-            for (i = 0; i < Width; i++) {
-                for (j = 0; j < Height/2; j++) {
-                    std::swap(ImageData[j * Width + i], ImageData[(Height - 1 - j) * Width + i]);
-                }
-            }
-        } else {
-            uint64_t i,j;
-            for (i = 0; i < Width*3; i++) {
-                for (j = 0; j < Height/2; j++) {
-                    std::swap(ImageData[j * Width*3 + i], ImageData[(Height - 1 - j) * Width*3 + i]);
-                }
-            }
-        }
-    }
+    Pending = Pending.then(Orientation::mirror(direction));
 }
 
 void PNMImage::Rotate(int direction) {
     // 0 - clockwise
     // 1 - counterclockwise
-    if (direction == 0) {
-        if (Type == 5) {
-            std::vector<byte> NewImageData;
-            uint64_t NewWidth, NewHeight;
-            NewHeight = Width;
-            NewWidth = Height;
-            try {
-                NewImageData.resize(Width * Height);
-            } catch (std::exception& e) {
-                char* error = nullptr;
-                strcat(error, "Memory error during rotation!\n");
-                strcat(error, e.what());
-                throw std::runtime_error(error);
-            }
-            for (uint64_t i = 0; i < Height; i++) {
-                for (uint64_t j = 0; j < Width; j++) {
-                    NewImageData[(NewWidth - i - 1) + j*NewWidth] = ImageData[i*Width + j];
-                }
-            }
-            Width = NewWidth;
-            Height = NewHeight;
-            ImageData = NewImageData;
-        } else {
-            std::vector<byte> NewImageData;
-            uint64_t NewWidth, NewHeight;
-            NewHeight = Width;
-            NewWidth = Height;
-            try {
-                NewImageData.resize(Width * Height * 3);
-            } catch (std::exception& e) {
-                char* error = nullptr;
-                strcat(error, "Memory error during rotation!\n");
-                strcat(error, e.what());
-                throw std::runtime_error(error);
-            }
-            for (uint64_t i = 0; i < Height; i++) {
-                for (uint64_t j = 0; j < Width; j++) {
-                    NewImageData[(NewWidth - i - 1)*3 + j*NewWidth*3] = ImageData[j*3 + Width*3*i];
-                    NewImageData[(NewWidth - i - 1)*3 + j*NewWidth*3 + 1] = ImageData[j*3 + Width*3*i + 1];
-                    NewImageData[(NewWidth - i - 1)*3 + j*NewWidth*3 + 2] = ImageData[j*3 + Width*3*i + 2];
-                }
-            }
-            Width = NewWidth;
-            Height = NewHeight;
-            ImageData = NewImageData;
-        }
+    Pending = Pending.then(Orientation::rotate(direction));
+    std::swap(Width, Height);
+}
+
+ImageView PNMImage::storedView(const Region& region) {
+    uint64_t width = Pending.Transpose ? Height : Width; // as the pixels are stored
+    uint64_t height = Pending.Transpose ? Width : Height;
+    ImageView whole(ImageData.data(), width, height, Channels, bytesPerSample());
+    return whole.sub(region.stored(Pending, Width, Height));
+}
+
+void PNMImage::Invert(const Region& region) {
+    invertView(storedView(region), ColourDepth, Alpha);
+}
+
+void PNMImage::Mirror(int direction, const Region& region) {
+    if (region.isWhole()) {
+        Mirror(direction);
+        return;
     }
-    if (direction == 1) {
-        if (Type == 5) {
-            std::vector<byte> NewImageData;
-            uint64_t NewWidth, NewHeight;
-            NewHeight = Width;
-            NewWidth = Height;
-            try {
-                NewImageData.resize(Width * Height);
-            } catch (std::exception& e) {
-                char* error = nullptr;
-                strcat(error, "Memory error during rotation!\n");
-                strcat(error, e.what());
-                throw std::runtime_error(error);
-            }
-            for (uint64_t i = 0; i < Height; i++) {
-                for (uint64_t j = 0; j < Width; j++) {
-                    NewImageData[j*NewWidth + i] = ImageData[(i + 1)*Width - 1 - j];
-                }
-            }
-            Width = NewWidth;
-            Height = NewHeight;
-            ImageData = NewImageData;
-        } else {
-            std::vector<byte> NewImageData;
-            uint64_t NewWidth, NewHeight;
-            NewHeight = Width;
-            NewWidth = Height;
-            try {
-                NewImageData.resize(Width * Height * 3);
-            } catch (std::exception& e) {
-                char* error = nullptr;
-                strcat(error, "Memory error during rotation!\n");
-                strcat(error, e.what());
-                throw std::runtime_error(error);
-            }
-            for (uint64_t i = 0; i < Height; i++) {
-                for (uint64_t j = 0; j < Width; j++) {
-                    NewImageData[(NewHeight - 1 - j)*NewWidth*3 + i*3] = ImageData[i*Width*3 + j*3];
-                    NewImageData[(NewHeight - 1 - j)*NewWidth*3 + i*3 + 1] = ImageData[i*Width*3 + j*3 + 1];
-                    NewImageData[(NewHeight - 1 - j)*NewWidth*3 + i*3 + 2] = ImageData[i*Width*3 + j*3 + 2];
-                }
-            }
-            Width = NewWidth;
-            Height = NewHeight;
-            ImageData = NewImageData;
+    // a flip of the rows of the image is a flip of the columns where it is stored transposed
+    mirrorView(storedView(region), Pending.Transpose ? 1 - direction : direction);
+}
+
+void PNMImage::crop(const Region& region) {
+    // the pending orientation is kept and later moves the smaller image only
+    Region area = region.within(Width, Height);
+    ImageView view = storedView(area);
+    std::vector<byte> cropped(view.rowSize() * view.Height);
+    copyView(view, cropped.data());
+    ImageData = std::move(cropped);
+    Width = area.Width;
+    Height = area.Height;
+}
+
+void PNMImage::settle() {
+    if (Pending.isIdentity()) {
+        return;
+    }
+    Orientation orientation = Pending;
+    Pending = Orientation();
+    uint64_t width = orientation.Transpose ? Height : Width; // as the pixels are stored
+    uint64_t height = orientation.Transpose ? Width : Height;
+    std::vector<byte> NewImageData;
+    if (orientation.Transpose) {
+        try {
+            NewImageData.resize(ImageData.size());
+        } catch (std::exception&) {
+            // not enough memory for a second image, the slower way needs none
         }
     }
+    if (NewImageData.empty()) {
+        orientInPlace(ImageData.data(), width, height, pixelSize(), orientation);
+        return;
+    }
+    orientPixels(ImageData.data(), NewImageData.data(), width, height, pixelSize(), orientation);
+    ImageData = std::move(NewImageData);
+}
+
+uint64_t PNMImage::bytesPerSample() const {
+    return ColourDepth > 255 ? 2 : 1;
+}
+
+uint64_t PNMImage::pixelSize() const {
+    return Channels * bytesPerSample();
 }
 
 bool PNMImage::isGrey() {
-    return Type == 5;
+    return Channels == 1 || (Channels == 2 && Alpha);
 }
 
 bool PNMImage::isColor() {
-    return Type == 6;
+    return Channels == 3 || (Channels == 4 && Alpha);
 }
 
-void PNMImage::drawPoint(int x, int y, double opacity, byte color, double gamma) { // видимо не умею считать вернул в развернутый вариант
+template<uint64_t C>
+void PNMImage::drawPoint(int x, int y, double opacity, const double* lineColorLinear, const GammaTable& light) {
     opacity = std::max(std::min(opacity, 1.0), 0.0);
     if (y < 0 || y >= Height || x < 0 || x >= Width)
         return;
     if (opacity == 0) {
         return;
     }
-    if (gamma == 0) {
-        double lineColorSRGB = color / 255.0;
-        double lineColorLinear = lineColorSRGB <= 0.04045 ? lineColorSRGB / 12.92 : pow((lineColorSRGB + 0.055) / 1.055, 2.4);
-        double picColorSRGB = ImageData[Width * y + x] / 255.0;
-        double picColorLinear = picColorSRGB <= 0.04045 ? picColorSRGB / 12.92 : pow((picColorSRGB + 0.055) / 1.055, 2.4);
-        double c = (1 - opacity) * picColorLinear + opacity * lineColorLinear;
-        double cSRGB = c <= 0.0031308 ? 12.92 * c : 1.055 * pow(c, 1 / 2.4) - 0.055;
-        ImageData[Width * y + x] = 255 * cSRGB;
-    } else {
-        double lineColorGamma = color / 255.0;
-        double lineColorLinear = pow(lineColorGamma, gamma);
-        double picColorGamma = ImageData[Width * y + x] / 255.0;
-        double picColorLinear = pow(picColorGamma, gamma);
-        double c = (1 - opacity) * picColorLinear + opacity * lineColorLinear;
-        double cGamma = pow(c, 1.0 / gamma);
-        ImageData[Width * y + x] = 255 * cGamma;
-    }
+    // the picture is blended on its own maxval, light holds its tables
+    withSample(bytesPerSample(), [&](auto sample) {
+        using Sample = decltype(sample);
+        byte* px = ImageData.data() + (Width * y + x) * Channels * Sample::Bytes;
+        // the coverage is shared by the channels, only the blend is done for each
+        double picColorLinear[C], c[C];
+        for (uint64_t k = 0; k < C; k++) {
+            picColorLinear[k] = light.decode(Sample::load(px + k * Sample::Bytes));
+        }
+        if (!Alpha) {
+            for (uint64_t k = 0; k < C; k++) {
+                c[k] = (1 - opacity) * picColorLinear[k] + opacity * lineColorLinear[k];
+            }
+        } else {
+            // the line goes over the picture, so the picture's own alpha weights its colour
+            byte* pa = px + C * Sample::Bytes;
+            double picAlpha = Sample::load(pa) / (double)ColourDepth;
+            double alpha = opacity + (1 - opacity) * picAlpha;
+            for (uint64_t k = 0; k < C; k++) {
+                c[k] = (opacity * lineColorLinear[k] + (1 - opacity) * picAlpha * picColorLinear[k]) / alpha;
+            }
+            Sample::store(pa, std::lround(ColourDepth * alpha));
+        }
+        for (uint64_t k = 0; k < C; k++) {
+            Sample::store(px + k * Sample::Bytes, light.encode(c[k]));
+        }
+    });
 }
 
 void PNMImage::drawThickLine(double x0, double y0, double x1, double y1, byte color, double thiccness, double gamma) {
-    if (!isGrey()) {
-        throw std::runtime_error("Error: Incorrect color!");
-    }
+    drawLines({{x0, y0, x1, y1, {color, color, color}, thiccness}}, gamma);
+}
+
+void PNMImage::drawThickLine(double x0, double y0, double x1, double y1, const byte (&color)[3], double thiccness,
+                             double gamma) {
+    drawLines({{x0, y0, x1, y1, {color[0], color[1], color[2]}, thiccness}}, gamma);
+}
+
+bool PNMImage::preparePrimitive(const LineRecord& record, double gamma, Primitive& primitive) const {
+    double x0 = record.X0, y0 = record.Y0, x1 = record.X1, y1 = record.Y1, thiccness = record.Thickness;
     if (thiccness <= 0)
-        return;
-    start = {x0,y0};
-    end = {x1,y1};
+        return false;
+    if (!std::isfinite(x0) || !std::isfinite(y0) || !std::isfinite(x1) || !std::isfinite(y1) || !std::isfinite(thiccness)) {
+        throw std::runtime_error("Error: the line is not finite!");
+    }
+    if (x0 == x1 && y0 == y1)
+        return false; // no direction to be thick across
+    // halves, so ends near the largest double do not overflow the difference
+    double dx = x1 * 0.5 - x0 * 0.5, dy = y1 * 0.5 - y0 * 0.5, length = std::hypot(dx, dy);
+    double ux = dx / length, uy = dy / length;
+    Point vec = {uy * 0.5 * thiccness, -ux * 0.5 * thiccness};
+    // color is given on the 0-255 scale
+    for (int k = 0; k < 3; k++) {
+        primitive.ColorLinear[k] = GammaTable::decodeGamma(record.Color[k] / 255.0, gamma);
+    }
+    // only the part of the centre line within half the thickness of the image can reach it,
+    // a pixel more keeps the cut ends well outside
+    double margin = 0.5 * thiccness + 1;
+    // The line is taken from foot, its point closest to the middle of the image, so ends far off the image round
+    // neither where it lies nor where it is cut. The distance of the middle from the line is a cross product
+    // of the ends, taken with fma while the products fit
+    double cx = Width / 2.0, cy = Height / 2.0;
+    double product = y0 * x1;
+    double distance = ((std::fma(x0, y1, -product) + std::fma(-y0, x1, product)) / 2 + (dx * cy - dy * cx)) / length;
+    if (!std::isfinite(distance))
+        distance = ux * (cy - y0) - uy * (cx - x0);
+    double reach = std::hypot(cx + margin, cy + margin); // the clipping box lies within this of the middle
+    if (std::abs(distance) > reach)
+        return false;
+    Point foot = {cx + distance * uy, cy - distance * ux};
+    double s0 = ux * (x0 - foot.x) + uy * (y0 - foot.y), s1 = ux * (x1 - foot.x) + uy * (y1 - foot.y);
+    if (s0 > reach || s1 < -reach)
+        return false;
+    // an end within reach is kept as given, one beyond it is brought in to reach along the line
+    Point a = s0 >= -reach ? Point{x0, y0} : Point{foot.x - reach * ux, foot.y - reach * uy};
+    Point b = s1 <= reach ? Point{x1, y1} : Point{foot.x + reach * ux, foot.y + reach * uy};
+    double first = 0, last = 1;
+    if (!clipSegment(a.x, a.y, b.x, b.y, -margin, -margin, Width + margin, Height + margin, first, last))
+        return false;
+    Point from = {a.x + first * (b.x - a.x), a.y + first * (b.y - a.y)};
+    Point to = {a.x + last * (b.x - a.x), a.y + last * (b.y - a.y)};
+    Point* clipped = primitive.Clipped;
+    clipped[0] = {from.x + vec.x, from.y + vec.y};
+    clipped[1] = {to.x + vec.x, to.y + vec.y};
+    clipped[2] = {to.x - vec.x, to.y - vec.y};
+    clipped[3] = {from.x - vec.x, from.y - vec.y};
+    double top = std::min(std::min(clipped[0].y, clipped[1].y), std::min(clipped[2].y, clipped[3].y));
+    double bottom = std::max(std::max(clipped[0].y, clipped[1].y), std::max(clipped[2].y, clipped[3].y));
+    primitive.FirstRow = (int64_t)std::max(0.0, std::floor(top));
+    primitive.LastRow = (int64_t)std::min((double)Height - 1, std::floor(bottom));
+    return primitive.FirstRow <= primitive.LastRow;
+}
 
-    Point vec = {(end.y - start.y) * 0.5 * thiccness / sqrt((end.y - start.y)*(end.y - start.y) + (start.x - end.x)*(start.x - end.x))
-            , (start.x - end.x) * 0.5 * thiccness / sqrt((end.y - start.y)*(end.y - start.y) + (start.x - end.x)*(start.x - end.x))};
-    Point A = {start.x + vec.x,start.y + vec.y};
-    Point B = {end.x + vec.x, end.y + vec.y};
-    Point C = {end.x - vec.x, end.y - vec.y};
-    Point D = {start.x - vec.x, start.y - vec.y};
-    line = {A, B, C, D}; // vector line
-    // drawing raster line
-    Point LT{std::min(std::min(A.x, B.x),std::min(C.x, D.x)), std::min(std::min(A.y, B.y),std::min(C.y, D.y))};
-    Point RB{std::max(std::max(A.x, B.x),std::max(C.x, D.x)), std::max(std::max(A.y, B.y),std::max(C.y, D.y))};
-    for (int x = (int)LT.x - 3; x <= RB.x + 3; x++) {
-        for (int y = (int)LT.y - 3; y <= RB.y + 3; y++) {
-            drawPoint(x, y, opacity(x, y), color, gamma);
+template<uint64_t C>
+void PNMImage::drawPrimitive(const Primitive& primitive, uint64_t left, uint64_t top, uint64_t right, uint64_t bottom,
+                             const GammaTable& light) {
+    // drawing raster line: the rows the clipped rectangle crosses, and in each row the pixels
+    // from its left to its right edge, both within the tile. The coverage is still taken on the whole line
+    int64_t firstRow = std::max(primitive.FirstRow, (int64_t)top);
+    int64_t lastRow = std::min(primitive.LastRow, (int64_t)bottom - 1);
+    for (int64_t y = firstRow; y <= lastRow; y++) {
+        double spanLeft, spanRight;
+        if (!rowSpan(primitive.Clipped, (double)y, y + 1.0, spanLeft, spanRight))
+            continue;
+        // rounding in the clipped corners may shave a sliver, a pixel of zero coverage more costs nothing
+        auto firstColumn = (int64_t)std::max((double)left, std::floor(spanLeft - EPS));
+        auto lastColumn = (int64_t)std::min((double)right - 1, std::floor(spanRight + EPS));
+        for (int64_t x = firstColumn; x <= lastColumn; x++) {
+            drawPoint<C>((int)x, (int)y, opacity(primitive.Clipped, (double)x, (double)y), primitive.ColorLinear, light);
         }
     }
 }
 
-double PNMImage::opacity(double x, double y) {
-    Point A = {x, y};
-    Point B = {x + 1, y};
-    Point C = {x + 1, y + 1};
-    Point D = {x, y + 1};
-
-    auto checkPoint = [](Rect Rectangle, Point p) -> bool {
-            auto triangleArea = [](Point A, Point B, Point C) -> double{
-                return sqrt((
-                                (
-                                        sqrt((A.x - B.x) * (A.x - B.x) + (A.y - B.y) * (A.y - B.y)) +
-                                        sqrt((A.x - C.x) * (A.x - C.x) + (A.y - C.y) * (A.y - C.y)) + // p
-                                        sqrt((C.x - B.x) * (C.x - B.x) + (C.y - B.y) * (C.y - B.y))
-                                ) / 2
-                       ) * (
-                                (
-                                        -sqrt((A.x - B.x) * (A.x - B.x) + (A.y - B.y) * (A.y - B.y)) +
-                                        sqrt((A.x - C.x) * (A.x - C.x) + (A.y - C.y) * (A.y - C.y)) + // p - a
-                                        sqrt((C.x - B.x) * (C.x - B.x) + (C.y - B.y) * (C.y - B.y))
-                                ) / 2
-                       ) * (
-                                (
-                                        sqrt((A.x - B.x) * (A.x - B.x) + (A.y - B.y) * (A.y - B.y)) -
-                                        sqrt((A.x - C.x) * (A.x - C.x) + (A.y - C.y) * (A.y - C.y)) + // p - b
-                                        sqrt((C.x - B.x) * (C.x - B.x) + (C.y - B.y) * (C.y - B.y))
-                                ) / 2
-                       ) * (
-                                (
-                                        sqrt((A.x - B.x) * (A.x - B.x) + (A.y - B.y) * (A.y - B.y)) +
-                                        sqrt((A.x - C.x) * (A.x - C.x) + (A.y - C.y) * (A.y - C.y)) - // p - c
-                                        sqrt((C.x - B.x) * (C.x - B.x) + (C.y - B.y) * (C.y - B.y))
-                                ) / 2
-                       ));
-            };
-            return fabs(
-                        sqrt((Rectangle.A.x - Rectangle.D.x) * (Rectangle.A.x - Rectangle.D.x) +
-                             (Rectangle.A.y - Rectangle.D.y) * (Rectangle.A.y - Rectangle.D.y)) *
-                        sqrt((Rectangle.A.x - Rectangle.B.x) * (Rectangle.A.x - Rectangle.B.x) +
-                             (Rectangle.A.y - Rectangle.B.y) * (Rectangle.A.y - Rectangle.B.y))
-                        -
-                        triangleArea(p, Rectangle.A, Rectangle.B) - triangleArea(p, Rectangle.B, Rectangle.C) -
-                        triangleArea(p, Rectangle.C, Rectangle.D) - triangleArea(p, Rectangle.D, Rectangle.A)
-                        ) < EPS;
-    };
-    if (checkPoint(line, A) &&
-        checkPoint(line, B) &&
-        checkPoint(line, C) &&
-        checkPoint(line, D))
-        return 1;
-    double area = 0;
-    for (double i = x; i < x+1; i += 0.1) {
-        for (double j = y; j < y+1; j += 0.1) {
-            if (checkPoint(line, {i,j})) {
-                area += 0.01;
+void PNMImage::drawLines(const std::vector<LineRecord>& lines, double gamma) {
+    settle();
+    bool colour = isColor();
+    if (!colour && !isGrey()) {
+        throw std::runtime_error("Error: Incorrect color!");
+    }
+    if (!colour) {
+        for (const LineRecord& record : lines) {
+            if (record.Color[0] != record.Color[1] || record.Color[0] != record.Color[2])
+                throw std::runtime_error("Error: an RGB line needs a colour image!");
+        }
+    }
+    const GammaTable& light = GammaTable::get(gamma, ColourDepth);
+    std::vector<Primitive> primitives;
+    primitives.reserve(lines.size());
+    for (const LineRecord& record : lines) {
+        Primitive primitive;
+        if (preparePrimitive(record, gamma, primitive))
+            primitives.push_back(primitive);
+    }
+    // every tile keeps the lines that cross it in the order they were given, so each pixel
+    // still blends them in that order
+    uint64_t columns = (Width + TileSize - 1) / TileSize, rows = (Height + TileSize - 1) / TileSize;
+    std::vector<std::vector<uint32_t>> bins(columns * rows);
+    for (uint64_t i = 0; i < primitives.size(); i++) {
+        const Primitive& primitive = primitives[i];
+        for (uint64_t row = primitive.FirstRow / TileSize; row <= (uint64_t)primitive.LastRow / TileSize; row++) {
+            // the span of the line over the whole strip of tiles holds its span in every row there
+            double spanLeft, spanRight;
+            if (!rowSpan(primitive.Clipped, (double)(row * TileSize), (double)((row + 1) * TileSize), spanLeft, spanRight))
+                continue;
+            auto firstColumn = (int64_t)std::max(0.0, std::floor(spanLeft - EPS));
+            auto lastColumn = (int64_t)std::min((double)Width - 1, std::floor(spanRight + EPS));
+            for (int64_t column = firstColumn / (int64_t)TileSize; column <= lastColumn / (int64_t)TileSize; column++) {
+                bins[row * columns + column].push_back((uint32_t)i);
             }
         }
     }
+    // a tile with a long thick line costs far more than an empty one, stealing evens that out
+    auto drawTile = [&](uint64_t tile) {
+        uint64_t left = tile % columns * TileSize, top = tile / columns * TileSize;
+        uint64_t right = std::min(Width, left + TileSize), bottom = std::min(Height, top + TileSize);
+        for (uint32_t i : bins[tile]) {
+            if (colour)
+                drawPrimitive<3>(primitives[i], left, top, right, bottom, light);
+            else
+                drawPrimitive<1>(primitives[i], left, top, right, bottom, light);
+        }
+    };
+    if (Pool) {
+        Pool->forEachStealing(bins.size(), drawTile);
+    } else {
+        for (uint64_t tile = 0; tile < bins.size(); tile++) {
+            drawTile(tile);
+        }
+    }
+}
 
-    return area;
+double PNMImage::opacity(const Point (&line)[4], double x, double y) {
+    // the exact part of the pixel square [x, x + 1] x [y, y + 1] inside the line: the square is clipped
+    // by the four sides of the rectangle in turn and the area of the polygon left over is the coverage.
+    // Each side adds one vertex at most, so eight are enough
+    Point polygon[8] = {{x, y}, {x + 1, y}, {x + 1, y + 1}, {x, y + 1}};
+    Point clipped[8];
+    int count = 4;
+    // the inside of every side is on the same hand, which one depends on how the corners wind
+    double winding = (line[1].x - line[0].x) * (line[2].y - line[1].y) - (line[1].y - line[0].y) * (line[2].x - line[1].x);
+    for (int side = 0; side < 4 && count > 0; side++) {
+        Point p = line[side], q = line[(side + 1) % 4];
+        auto inside = [&](const Point& v) -> double {
+            double cross = (q.x - p.x) * (v.y - p.y) - (q.y - p.y) * (v.x - p.x);
+            return winding < 0 ? -cross : cross;
+        };
+        int kept = 0;
+        for (int i = 0; i < count; i++) {
+            const Point& u = polygon[i];
+            const Point& v = polygon[(i + 1) % count];
+            double du = inside(u), dv = inside(v);
+            if (du >= 0) {
+                clipped[kept++] = u;
+            }
+            if ((du >= 0) != (dv >= 0)) {
+                double t = du / (du - dv);
+                clipped[kept++] = {u.x + t * (v.x - u.x), u.y + t * (v.y - u.y)};
+            }
+        }
+        std::copy(clipped, clipped + kept, polygon);
+        count = kept;
+    }
+    double area = 0; // the shoelace formula
+    for (int i = 0; i < count; i++) {
+        const Point& u = polygon[i];
+        const Point& v = polygon[(i + 1) % count];
+        area += u.x * v.y - v.x * u.y;
+    }
+    return std::abs(area) / 2;
 }
@@ -2,55 +2,125 @@
 #define LAB_2_PNMIMAGE_H
 
 #include <vector>
+#include <string>
 #include <cstdint>
 #include <iostream>
 #include <fstream>
+#include "PixelBuffer.h"
+#include "PNMStream.h"
+#include "PixelKernels.h"
+#include "ImageView.h"
+#include "GammaTable.h"
+#include "ThreadPool.h"
 
 using byte = unsigned char;
 
 class PNMImage {
+public:
+    // one line of drawLines, the arguments of drawThickLine
+    struct LineRecord {
+        double X0, Y0, X1, Y1;
+        byte Color[3]; // red, green and blue on the 0-255 scale, all three alike for a grey line
+        double Thickness;
+    };
+
 private:
     struct Point {
         double x;
         double y;
         Point& operator=(const Point& other) = default;
     };
-    struct Rect {
-        Point A, B, C, D;
+    // a line ready to be drawn
+    struct Primitive {
+        // the part of the line that can reach the image, its corners in order. Its rows and spans are walked
+        // and the coverage is taken on it, so a line that reaches far off the image keeps the precision of one on it
+        Point Clipped[4];
+        int64_t FirstRow, LastRow; // the rows of the image Clipped crosses
+        double ColorLinear[3];
     };
 
-    std::vector<byte> Buffer;
-    std::vector<byte> ImageData;
+    PixelBuffer ImageData;
     uint64_t Size, Width, Height, ColourDepth;
+    uint64_t Channels;     // 1 for P5, 3 for P6, DEPTH for P7
+    std::string TupleType; // P7 only
+    bool Alpha;            // the last channel is alpha
     uint8_t Type;
-    struct Point start, end;
-    struct Rect line;
+    // Mirror and Rotate calls not applied to the pixels yet, Width and Height already follow them.
+    // Invert treats every pixel alike and leaves it pending.
+    Orientation Pending;
+
+    // moves the pixels once for every pending Mirror and Rotate
+    void settle();
+
+    // the pixels of region as they are stored, Pending is not applied to them
+    ImageView storedView(const Region& region);
+
+    // Blends the line colour, linear, over pixel (x, y) with opacity, channel by channel.
+    // C is the number of colour channels, 1 or 3, so the loops over them have a fixed length
+    template<uint64_t C>
+    void drawPoint(int x, int y, double opacity, const double* lineColorLinear, const GammaTable& light);
+
+    // the part of the pixel square from (x, y) to (x + 1, y + 1) inside the line, exact
+    static double opacity(const Point (&line)[4], double x, double y);
 
-    void drawPoint(int, int, double, byte, double);
+    // false when the line leaves the image as it is
+    bool preparePrimitive(const LineRecord& record, double gamma, Primitive& primitive) const;
 
-    double opacity(double x, double y);
+    // draws the pixels of primitive within columns left to right and rows top to bottom, both past the end
+    template<uint64_t C>
+    void drawPrimitive(const Primitive& primitive, uint64_t left, uint64_t top, uint64_t right, uint64_t bottom,
+                       const GammaTable& light);
 
 public:
+    // the side of the square tiles drawLines bins the lines into
+    static const uint64_t TileSize = 64;
 
-    static std::vector<byte> ReadBinary(const char*, uint64_t);
+    ThreadPool* Pool = nullptr; // drawLines spreads its tiles over it, nullptr - this thread only
 
-    static void WriteBinary(const char*, const std::vector<byte>&);
+    // One image of a multi-image file, the payload stays where the reader found it.
+    explicit PNMImage(PNMFrame&& frame);
 
-    explicit PNMImage(const char*);
+    [[nodiscard]] PNMHeader header() const;
 
-    void Export(const char*);
+    // Appends the image to a multi-image output.
+    void Export(PNMFrameWriter& writer);
 
     void Invert();
 
+    // inverts region only, it is found where the pixels are stored so a pending Mirror or Rotate stays pending
+    void Invert(const Region& region);
+
     void Mirror(int);
 
+    // mirrors the pixels within region, the rest of the image stays where it is
+    void Mirror(int direction, const Region& region);
+
+    // keeps region only, the pixels outside it are never read
+    void crop(const Region& region);
+
     void Rotate(int direction);
 
+    // 2 when maxval is above 255, samples are then stored big-endian
+    [[nodiscard]] uint64_t bytesPerSample() const;
+
+    [[nodiscard]] uint64_t pixelSize() const;
+
+    // grey or RGB samples, either may carry an alpha channel after them
     bool isGrey();
 
     bool isColor();
 
     void drawThickLine(double, double, double, double, byte, double, double);
+
+    // an RGB line, on colour images only
+    void drawThickLine(double x0, double y0, double x1, double y1, const byte (&color)[3], double thiccness,
+                       double gamma);
+
+    // Draws the lines in order, as drawThickLine one by one would. Grey lines go on grey and colour images,
+    // RGB lines on colour images only. Each line is noted in the tiles it crosses,
+    // then every tile draws its lines while its pixels are in the cache. Tiles share no pixels, so they are
+    // spread over Pool and the result is the same on any number of threads.
+    void drawLines(const std::vector<LineRecord>& lines, double gamma);
 };
 
 
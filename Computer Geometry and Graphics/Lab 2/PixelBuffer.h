@@ -0,0 +1,103 @@
+#ifndef LAB_1_PIXELBUFFER_H
+#define LAB_1_PIXELBUFFER_H
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+using byte = unsigned char;
+
+// Whole file mapped into memory. The mapping is private, so writing through data()
+// copies only the touched pages and never changes the file on disk.
+class MappedFile {
+private:
+    std::string Path;
+    byte* Data = nullptr;
+    uint64_t Size = 0;
+    bool Mapped = false;
+    std::vector<byte> Fallback; // file contents when mmap is not available
+
+public:
+    explicit MappedFile(const char* path);
+
+    MappedFile(const MappedFile& other) = delete;
+
+    MappedFile& operator=(const MappedFile& other) = delete;
+
+    ~MappedFile();
+
+    [[nodiscard]] byte* data() const;
+
+    [[nodiscard]] uint64_t size() const;
+
+    [[nodiscard]] const std::string& path() const;
+};
+
+// Pixel payload of a PNMImage: either a view into a MappedFile or an owned vector.
+// Anything that changes the size moves the data into the owned vector first.
+class PixelBuffer {
+private:
+    std::shared_ptr<MappedFile> File;
+    std::vector<byte> Owned;
+    byte* Data = nullptr;
+    uint64_t Length = 0;
+
+    void adopt();
+
+public:
+    PixelBuffer() = default;
+
+    PixelBuffer(std::shared_ptr<MappedFile> file, uint64_t offset, uint64_t length);
+
+    PixelBuffer(std::vector<byte>&& data);
+
+    PixelBuffer(const PixelBuffer& other);
+
+    PixelBuffer(PixelBuffer&& other) noexcept;
+
+    PixelBuffer& operator=(const PixelBuffer& other);
+
+    PixelBuffer& operator=(PixelBuffer&& other) noexcept;
+
+    PixelBuffer& operator=(const std::vector<byte>& data);
+
+    PixelBuffer& operator=(std::vector<byte>&& data);
+
+    byte& operator[](uint64_t i) { return Data[i]; }
+
+    const byte& operator[](uint64_t i) const { return Data[i]; }
+
+    [[nodiscard]] byte* data() { return Data; }
+
+    [[nodiscard]] const byte* data() const { return Data; }
+
+    [[nodiscard]] uint64_t size() const { return Length; }
+
+    [[nodiscard]] bool empty() const { return Length == 0; }
+
+    byte* begin() { return Data; }
+
+    byte* end() { return Data + Length; }
+
+    [[nodiscard]] const byte* begin() const { return Data; }
+
+    [[nodiscard]] const byte* end() const { return Data + Length; }
+
+    [[nodiscard]] bool isMapped() const;
+
+    void detach();
+
+    void detachFrom(const char* path);
+
+    void push_back(byte value);
+
+    void resize(uint64_t length);
+
+    void reserve(uint64_t length);
+
+    void clear();
+};
+
+
+#endif
@@ -0,0 +1,330 @@
+#include "PixelKernels.h"
+#include "SimdKernels.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+    // A pixel as an opaque block of N bytes, so moves compile to plain loads and stores.
+    template<uint64_t N>
+    struct Pixel {
+        byte b[N];
+    };
+
+    // Calls f with a Pixel<N> for the common pixel sizes and returns false for the rest.
+    template<typename F>
+    bool withPixel(uint64_t pixelSize, F&& f) {
+        switch (pixelSize) {
+            case 1: f(Pixel<1>{}); return true;
+            case 2: f(Pixel<2>{}); return true;
+            case 3: f(Pixel<3>{}); return true;
+            case 4: f(Pixel<4>{}); return true;
+            case 6: f(Pixel<6>{}); return true;
+            case 8: f(Pixel<8>{}); return true;
+            default: return false;
+        }
+    }
+
+    template<typename P>
+    void mirrorRowsOf(byte* rows, uint64_t count, uint64_t width) {
+        auto* pixels = reinterpret_cast<P*>(rows);
+        for (uint64_t i = 0; i < count; i++) {
+            std::reverse(pixels + i * width, pixels + (i + 1) * width);
+        }
+    }
+
+    // Pixels of one tile are read and written while both stay in L1, about 16 KiB of source
+    // and as much of destination. A row of tiles then stays in L2, so the strided writes
+    // of a transpose stop missing the cache and the TLB.
+    const uint64_t TileBytes = 16 * 1024;
+
+    uint64_t tileSide(uint64_t pixelSize) {
+        uint64_t side = 8;
+        while ((side * 2) * (side * 2) * pixelSize <= TileBytes) {
+            side *= 2;
+        }
+        return side;
+    }
+
+    // Source pixel (j, i) goes to (x, y): transposed first, then flipped.
+    // Within a tile the source is read along rows and every destination row gets a short run.
+    template<typename Copy>
+    void orientTiles(uint64_t width, uint64_t height, uint64_t pixelSize, const Orientation& orientation,
+                     uint64_t firstRow, uint64_t lastRow, Copy&& copy) {
+        uint64_t newWidth = orientation.Transpose ? height : width;
+        uint64_t newHeight = orientation.Transpose ? width : height;
+        uint64_t side = tileSide(pixelSize);
+        for (uint64_t i0 = firstRow; i0 < lastRow; i0 += side) {
+            uint64_t i1 = std::min(i0 + side, lastRow);
+            for (uint64_t j0 = 0; j0 < width; j0 += side) {
+                uint64_t j1 = std::min(j0 + side, width);
+                for (uint64_t i = i0; i < i1; i++) {
+                    for (uint64_t j = j0; j < j1; j++) {
+                        uint64_t x = orientation.Transpose ? i : j;
+                        uint64_t y = orientation.Transpose ? j : i;
+                        if (orientation.FlipX) x = newWidth - 1 - x;
+                        if (orientation.FlipY) y = newHeight - 1 - y;
+                        copy(y * newWidth + x, i * width + j);
+                    }
+                }
+            }
+        }
+    }
+
+    // The transpose of a tile walks destination columns with a fixed stride, no index is
+    // recomputed per pixel. Flips only change where a column starts and which way it runs.
+    // Pixel<3> makes this the P6 kernel: each move is a two and a one byte copy, which
+    // measured faster than reading four bytes per pixel or regrouping 4x4 blocks.
+    template<typename P>
+    void transposeOf(const byte* src, byte* dst, uint64_t width, uint64_t height, const Orientation& orientation,
+                     uint64_t firstRow, uint64_t lastRow) {
+        auto* from = reinterpret_cast<const P*>(src);
+        auto* to = reinterpret_cast<P*>(dst);
+        uint64_t newWidth = height;
+        int64_t step = orientation.FlipY ? -(int64_t)newWidth : (int64_t)newWidth;
+        uint64_t side = tileSide(sizeof(P));
+        for (uint64_t i0 = firstRow; i0 < lastRow; i0 += side) {
+            uint64_t i1 = std::min(i0 + side, lastRow);
+            for (uint64_t j0 = 0; j0 < width; j0 += side) {
+                uint64_t j1 = std::min(j0 + side, width);
+                for (uint64_t i = i0; i < i1; i++) {
+                    uint64_t x = orientation.FlipX ? newWidth - 1 - i : i;
+                    uint64_t y = orientation.FlipY ? width - 1 - j0 : j0;
+                    const P* in = from + i * width + j0;
+                    P* out = to + y * newWidth + x;
+                    for (uint64_t j = j0; j < j1; j++) {
+                        *out = *in++;
+                        out += step;
+                    }
+                }
+            }
+        }
+    }
+
+    // Index of the source pixel that the oriented image has at target.
+    struct SourceIndex {
+        uint64_t Width, Height;
+        Orientation Orient;
+
+        uint64_t operator()(uint64_t target) const {
+            uint64_t newWidth = Orient.Transpose ? Height : Width;
+            uint64_t newHeight = Orient.Transpose ? Width : Height;
+            uint64_t x = target % newWidth, y = target / newWidth;
+            if (Orient.FlipX) x = newWidth - 1 - x;
+            if (Orient.FlipY) y = newHeight - 1 - y;
+            return Orient.Transpose ? x * Width + y : y * Width + x;
+        }
+    };
+
+    // Walks every cycle of the permutation once, pulling each pixel into the place of the one before.
+    // On a square the cycles are at most four long, a cycle is then walked from its smallest index
+    // and no bits are needed.
+    template<typename Move, typename Hold, typename Put>
+    void followCycles(uint64_t count, bool square, const SourceIndex& source, Move&& move, Hold&& hold, Put&& put) {
+        std::vector<bool> visited(square ? 0 : count);
+        for (uint64_t start = 0; start < count; start++) {
+            if (square) {
+                uint64_t k = source(start);
+                while (k > start) {
+                    k = source(k);
+                }
+                if (k != start) {
+                    continue;
+                }
+            } else if (visited[start]) {
+                continue;
+            }
+            hold(start);
+            uint64_t current = start;
+            while (true) {
+                uint64_t from = source(current);
+                if (!square) {
+                    visited[current] = true;
+                }
+                if (from == start) {
+                    break;
+                }
+                move(current, from);
+                current = from;
+            }
+            put(current);
+        }
+    }
+}
+
+Orientation Orientation::mirror(int direction) {
+    Orientation result;
+    (direction == 0 ? result.FlipX : result.FlipY) = true;
+    return result;
+}
+
+Orientation Orientation::rotate(int direction) {
+    // clockwise puts column j of the source on row j, read right to left
+    Orientation result;
+    result.Transpose = true;
+    (direction == 0 ? result.FlipX : result.FlipY) = true;
+    return result;
+}
+
+Orientation Orientation::then(const Orientation& next) const {
+    // a flip followed by a transpose is the transpose followed by the other flip
+    Orientation result;
+    result.Transpose = Transpose != next.Transpose;
+    result.FlipX = (next.Transpose ? FlipY : FlipX) != next.FlipX;
+    result.FlipY = (next.Transpose ? FlipX : FlipY) != next.FlipY;
+    return result;
+}
+
+bool Orientation::isIdentity() const {
+    return !Transpose && !FlipX && !FlipY;
+}
+
+bool Orientation::operator==(const Orientation& other) const {
+    return Transpose == other.Transpose && FlipX == other.FlipX && FlipY == other.FlipY;
+}
+
+bool Orientation::operator!=(const Orientation& other) const {
+    return !(*this == other);
+}
+
+void invertSamples(byte* data, uint64_t length, uint64_t bytesPerSample, uint64_t maxval,
+                   uint64_t channels, bool alpha) {
+    if (!alpha && maxval == (bytesPerSample == 2 ? Sample16::Full : Sample8::Full)) {
+        // maxval - value is ~value when every bit is used, big-endian or not
+        invertBytes(data, length);
+        return;
+    }
+    // with alpha only the colour samples of each pixel are turned over
+    uint64_t colours = alpha ? channels - 1 : channels;
+    withSample(bytesPerSample, [&](auto sample) {
+        using Sample = decltype(sample);
+        uint64_t pixelSize = channels * Sample::Bytes;
+        for (uint64_t i = 0; i + pixelSize <= length; i += pixelSize) {
+            for (uint64_t k = 0; k < colours; k++) {
+                byte* p = data + i + k * Sample::Bytes;
+                uint32_t value = Sample::load(p);
+                Sample::store(p, value > maxval ? 0 : maxval - value);
+            }
+        }
+    });
+}
+
+void mirrorRows(byte* rows, uint64_t count, uint64_t width, uint64_t pixelSize) {
+    if (pixelSize == 1 || pixelSize == 3) {
+        for (uint64_t i = 0; i < count; i++) {
+            byte* row = rows + i * width * pixelSize;
+            if (pixelSize == 1) {
+                reverseBytes(row, width);
+            } else {
+                reverseTriples(row, width);
+            }
+        }
+        return;
+    }
+    bool done = withPixel(pixelSize, [&](auto pixel) {
+        mirrorRowsOf<decltype(pixel)>(rows, count, width);
+    });
+    if (done) {
+        return;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        byte* row = rows + i * width * pixelSize;
+        for (uint64_t j = 0; j < width / 2; j++) {
+            std::swap_ranges(row + j * pixelSize, row + (j + 1) * pixelSize, row + (width - 1 - j) * pixelSize);
+        }
+    }
+}
+
+void mirrorColumns(byte* data, uint64_t width, uint64_t height, uint64_t pixelSize) {
+    Orientation flip;
+    flip.FlipY = true;
+    orientRowPairs(data, width, height, pixelSize, flip, 0, height / 2);
+}
+
+void orientRowPairs(byte* data, uint64_t width, uint64_t height, uint64_t pixelSize, const Orientation& orientation,
+                    uint64_t firstPair, uint64_t count) {
+    // whole rows trade places through a small buffer, memcpy moves them as wide as the CPU allows
+    byte buffer[4096];
+    uint64_t rowSize = width * pixelSize;
+    for (uint64_t i = firstPair; i < firstPair + count; i++) {
+        byte* top = data + i * rowSize;
+        byte* bottom = data + (height - 1 - i) * rowSize;
+        if (orientation.FlipX) {
+            mirrorRows(top, 1, width, pixelSize);
+            if (bottom != top) {
+                mirrorRows(bottom, 1, width, pixelSize);
+            }
+        }
+        if (!orientation.FlipY || bottom == top) {
+            continue;
+        }
+        for (uint64_t k = 0; k < rowSize; k += sizeof(buffer)) {
+            uint64_t length = std::min<uint64_t>(sizeof(buffer), rowSize - k);
+            std::memcpy(buffer, top + k, length);
+            std::memcpy(top + k, bottom + k, length);
+            std::memcpy(bottom + k, buffer, length);
+        }
+    }
+}
+
+void rotatePixels(const byte* src, byte* dst, uint64_t width, uint64_t height, uint64_t pixelSize, int direction) {
+    orientPixels(src, dst, width, height, pixelSize, Orientation::rotate(direction));
+}
+
+void orientPixels(const byte* src, byte* dst, uint64_t width, uint64_t height, uint64_t pixelSize,
+                  const Orientation& orientation) {
+    orientPixelRows(src, dst, width, height, pixelSize, orientation, 0, height);
+}
+
+void orientPixelRows(const byte* src, byte* dst, uint64_t width, uint64_t height, uint64_t pixelSize,
+                     const Orientation& orientation, uint64_t firstRow, uint64_t count) {
+    uint64_t lastRow = firstRow + count;
+    bool done = withPixel(pixelSize, [&](auto pixel) {
+        using P = decltype(pixel);
+        if (orientation.Transpose) {
+            transposeOf<P>(src, dst, width, height, orientation, firstRow, lastRow);
+            return;
+        }
+        auto* from = reinterpret_cast<const P*>(src);
+        auto* to = reinterpret_cast<P*>(dst);
+        orientTiles(width, height, sizeof(P), orientation, firstRow, lastRow, [&](uint64_t target, uint64_t source) {
+            to[target] = from[source];
+        });
+    });
+    if (done) {
+        return;
+    }
+    orientTiles(width, height, pixelSize, orientation, firstRow, lastRow, [&](uint64_t to, uint64_t from) {
+        std::memcpy(dst + to * pixelSize, src + from * pixelSize, pixelSize);
+    });
+}
+
+void orientInPlace(byte* data, uint64_t width, uint64_t height, uint64_t pixelSize, const Orientation& orientation) {
+    if (!orientation.Transpose) {
+        if (orientation.FlipX && orientation.FlipY) {
+            // both mirrors are the whole payload read backwards
+            mirrorRows(data, 1, width * height, pixelSize);
+        } else {
+            orientRowPairs(data, width, height, pixelSize, orientation, 0, (height + 1) / 2);
+        }
+        return;
+    }
+    SourceIndex source{width, height, orientation};
+    uint64_t count = width * height;
+    bool square = width == height;
+    bool done = withPixel(pixelSize, [&](auto pixel) {
+        auto* pixels = reinterpret_cast<decltype(pixel)*>(data);
+        followCycles(count, square, source,
+                     [&](uint64_t to, uint64_t from) { pixels[to] = pixels[from]; },
+                     [&](uint64_t index) { pixel = pixels[index]; },
+                     [&](uint64_t index) { pixels[index] = pixel; });
+    });
+    if (done) {
+        return;
+    }
+    std::vector<byte> held(pixelSize);
+    followCycles(count, square, source,
+                 [&](uint64_t to, uint64_t from) { std::memcpy(data + to * pixelSize, data + from * pixelSize, pixelSize); },
+                 [&](uint64_t index) { std::memcpy(held.data(), data + index * pixelSize, pixelSize); },
+                 [&](uint64_t index) { std::memcpy(data + index * pixelSize, held.data(), pixelSize); });
+}
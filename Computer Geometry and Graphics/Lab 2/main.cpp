@@ -1,24 +1,123 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <string>
+#include <cstring>
+#include <vector>
 #include "PNMImage.h"
 
 using byte = unsigned char;
 
+// a brightness, one number from 0 to 255 for a grey line or three of them as r,g,b for a colour one
+bool parseColor(const std::string& text, byte (&color)[3]) {
+    std::string token;
+    std::istringstream list(text);
+    int values[3], count = 0;
+    while (std::getline(list, token, ',')) {
+        if (count == 3 || token.empty() || token.size() > 3 || token.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        values[count++] = std::stoi(token);
+        if (values[count - 1] > 255)
+            return false;
+    }
+    if (count != 1 && count != 3)
+        return false;
+    for (int k = 0; k < 3; k++) {
+        color[k] = values[count == 1 ? 0 : k];
+    }
+    return true;
+}
+
+// One line per record: <brightness> <thickness> <x0> <y0> <x1> <y1>, the arguments of a single line.
+// Empty lines and everything from # to the end of a line are skipped
+std::vector<PNMImage::LineRecord> readLineRecords(std::istream& in) {
+    std::vector<PNMImage::LineRecord> lines;
+    std::string text;
+    for (uint64_t number = 1; std::getline(in, text); number++) {
+        text = text.substr(0, text.find('#'));
+        if (text.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+        std::istringstream fields(text);
+        PNMImage::LineRecord line{};
+        std::string color;
+        if (!(fields >> color >> line.Thickness >> line.X0 >> line.Y0 >> line.X1 >> line.Y1) || !(fields >> std::ws).eof() ||
+            !parseColor(color, line.Color)) {
+            throw std::runtime_error("Error: invalid line record on line " + std::to_string(number) + "!");
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+// the lines of a batch from a file, or from stdin for -
+std::vector<PNMImage::LineRecord> readLineRecords(const char* path) {
+    if (isStandardStream(path))
+        return readLineRecords(std::cin);
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Error when opening file.");
+    }
+    return readLineRecords(in);
+}
+
 int main(int argc, char* argv[]) {
+    if (argc >= 3 && strcmp(argv[1], "-p") == 0) { // -p <files>: report the headers, the pixels are never read
+        return probeFiles(argc - 2, argv + 2);
+    }
+    unsigned threads = 1; // -j <threads> at the end: draw on this many threads, 0 - one per core
+    if (argc >= 5 && strcmp(argv[argc - 2], "-j") == 0) {
+        char* end;
+        threads = std::strtoul(argv[argc - 1], &end, 10);
+        if (*end != '\0' || end == argv[argc - 1]) {
+            std::cerr << "Error: invalid thread count!" << std::endl;
+            return 1;
+        }
+        argc -= 2;
+    }
+    ThreadPool pool(threads);
+    if (argc >= 5 && strcmp(argv[3], "-l") == 0) { // -l <lines> [gamma]: every line of a file in one pass
+        if (argc > 6) {
+            std::cerr << "Incorrect number of arguments" << std::endl;
+            return 1;
+        }
+        try {
+            if (isStandardStream(argv[1]) && isStandardStream(argv[4])) {
+                throw std::runtime_error("Error: the image and the lines can not both come from stdin!");
+            }
+            std::vector<PNMImage::LineRecord> lines = readLineRecords(argv[4]);
+            double gamma = argc == 6 ? std::stof(argv[5]) : 0.0;
+            PNMFrameReader frames(argv[1]);
+            PNMFrameWriter writer(argv[2], frames.isSource(argv[2]));
+            PNMFrame frame;
+            while (frames.next(frame)) {
+                PNMImage picture(std::move(frame));
+                picture.Pool = &pool;
+                picture.drawLines(lines, gamma);
+                picture.Export(writer);
+            }
+            writer.finish();
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
     if (argc < 9 || argc > 10) {
         std::cerr << "Incorrect number of arguments" << std::endl;
         return 1;
     }
 
     char *inputFileName, *outputFileName;
-    byte color;
+    byte color[3];
     bool gammaDefined;
     double thickness, x0, y0, x1, y1, gamma;
 
     try {
         inputFileName = strdup(argv[1]);
         outputFileName = strdup(argv[2]);
-        color = std::stoi(argv[3]);
+        if (!parseColor(argv[3], color)) {
+            throw std::runtime_error("Error: invalid brightness!");
+        }
         thickness = std::stod(argv[4]);
         x0 = std::stod(argv[5]);
         y0 = std::stod(argv[6]);
@@ -31,26 +130,21 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    PNMImage *picture = nullptr;
-
-    try {
-        picture = new PNMImage(inputFileName);
-    } catch (const std::exception& e) {
-        std::cerr << e.what() << std::endl;
-        return 1;
-    }
-    try {
-        if (gammaDefined)
-            picture->drawThickLine(x0, y0, x1, y1, color, thickness, gamma);
-        else
-            picture->drawThickLine(x0, y0, x1, y1, color, thickness, 0);
-    } catch (const std::exception& e) {
-        std::cerr << e.what() << std::endl;
-        return 1;
-    }
-
+    // the line is drawn on every image of a multi-image file
     try {
-        picture->Export(outputFileName);
+        PNMFrameReader frames(inputFileName);
+        PNMFrameWriter writer(outputFileName, frames.isSource(outputFileName));
+        PNMFrame frame;
+        while (frames.next(frame)) {
+            PNMImage picture(std::move(frame));
+            picture.Pool = &pool;
+            if (gammaDefined)
+                picture.drawThickLine(x0, y0, x1, y1, color, thickness, gamma);
+            else
+                picture.drawThickLine(x0, y0, x1, y1, color, thickness, 0);
+            picture.Export(writer);
+        }
+        writer.finish();
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return 1;
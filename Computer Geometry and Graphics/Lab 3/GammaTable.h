@@ -0,0 +1,36 @@
+#ifndef LAB_2_GAMMATABLE_H
+#define LAB_2_GAMMATABLE_H
+
+#include <cstdint>
+#include <vector>
+
+// Gamma decoding and encoding of the samples of one maxval through tables, so no pixel calls pow.
+// gamma 0 - sRGB, any other - a plain power curve. The tables give the same values as the formulas.
+class GammaTable {
+private:
+    uint64_t Maxval;
+    std::vector<double> Decoded;    // decodeGamma(i / maxval) of every value i the sample size holds
+    std::vector<double> Encoded;    // encodeGamma(i / full) * maxval of every value i of the full scale, 255 or 65535
+    std::vector<double> Thresholds; // Thresholds[i] - the least linear value that is stored as i + 1 or more
+
+    GammaTable(double gamma, uint64_t maxval);
+
+public:
+    // the tables of gamma and maxval, made on first use and kept for the rest of the run
+    static const GammaTable& get(double gamma, uint64_t maxval);
+
+    [[nodiscard]] double decode(uint32_t sample) const { return Decoded[sample]; }
+
+    // encodeGamma(value / full) * maxval for a value on the full scale of the sample size
+    [[nodiscard]] double encodeFull(uint32_t value) const { return Encoded[value]; }
+
+    // the sample maxval * encodeGamma(linear) rounds down to, linear in [0, 1]
+    [[nodiscard]] uint32_t encode(double linear) const;
+
+    static double decodeGamma(double value, double gamma);
+
+    static double encodeGamma(double value, double gamma);
+};
+
+
+#endif
@@ -1,4 +1,8 @@
 #include "PNMImage.h"
+#include "PNMHeader.h"
+#include "PNMStream.h"
+#include "PixelKernels.h"
+#include "GammaTable.h"
 #include <iostream>
 #include <fstream>
 #include <algorithm>
@@ -7,349 +11,144 @@
 #include <vector>
 #include <cmath>
 #include <exception>
+#include <cstring>
+#include <memory>
 #include <random>
 
 const double EPS = 1e-5;
 using byte = unsigned char;
 
-std::vector<byte> PNMImage::ReadBinary(const char* path, uint64_t length) {
-    std::ifstream is(path, std::ios::binary);
-    if (!is) {
-        throw std::runtime_error("Error when opening file.");
-    }
-    std::vector<byte> data;
-    try {
-        data.resize(length);
-    } catch (std::exception& e) {
-        char* error = nullptr;
-        strcat(error, "Buffer error, file too large!\n");
-        strcat(error, e.what());
-        throw std::runtime_error(error);
-    }
-
-    try {
-        is.read(reinterpret_cast<char*>(data.data()), length);
-    } catch (std::exception& e) {
-        char* error = nullptr;
-        strcat(error, "Reading error, file could not be read properly!\n");
-        strcat(error, e.what());
-        throw std::runtime_error(error);
-    }
-    is.close();
-    return data;
+PNMImage::PNMImage(PNMFrame&& frame) {
+    Type = frame.Header.Type;
+    Width = frame.Header.Width;
+    Height = frame.Header.Height;
+    ColourDepth = frame.Header.ColourDepth;
+    Channels = frame.Header.channels();
+    TupleType = frame.Header.TupleType;
+    Alpha = frame.Header.hasAlpha();
+    Size = frame.Header.DataOffset + frame.Header.DataSize;
+    ImageData = std::move(frame.Data);
 }
 
-void PNMImage::WriteBinary(const char* path, const std::vector<byte>& vector) {
-    std::ofstream os(path, std::ios::binary);
-    if (!os) {
-        throw std::runtime_error("Error creating output file!");
-    }
-    try {
-        os.write(reinterpret_cast<const char*>(&vector[0]), vector.size());
-    } catch (std::exception& e) {
-        char* error = nullptr;
-        strcat(error, "Writing error, file could not be written properly!\n");
-        strcat(error, e.what());
-        throw std::runtime_error(error);
-    }
-    os.flush();
-    os.close();
+PNMHeader PNMImage::header() const {
+    PNMHeader header;
+    header.Type = Type;
+    header.Width = Width;
+    header.Height = Height;
+    header.ColourDepth = ColourDepth;
+    header.Depth = Channels;
+    header.TupleType = TupleType;
+    return header;
 }
 
-PNMImage::PNMImage(const char* path) {
-    //GET FILE SIZE
-    std::error_code ec{};
-    Size = std::filesystem::file_size(path, ec);
-    if (ec != std::error_code{}) {
-        throw std::runtime_error("Error when accessing file.");
-    }
-    //READ BUFFER
-    Buffer = ReadBinary(path, Size);
-
-    //PARSE BUFFER
-    int flag = 0; // comment flag 0 - not in comment
-    // 1 - in comment
-    // 2 - in data
-    std::vector<byte> Header;
-    std::vector<int> numbers;
-    for (int i = 0; i < Buffer.size(); i++) {
-        char c = Buffer[i];
-        if (flag == 2) {
-            ImageData.push_back(c);
-        }
-        if (flag == 0) {
-            if (c == '#' && numbers.size() < 4) {
-                flag = 1; // in comment
-                continue;
-            }
-            if (c == '\r' || c == '\n' || c == ' ' || c == '\0') {
-                int32_t number = -1;
-                int it = i - 1;
-                while (it > 0) {
-                    if ('0' <= Buffer[it] && Buffer[it] <= '9') {
-                        if (number == -1) number++;
-                        number += (Buffer[it] - '0') * (int)pow(10, i - it - 1);
-                    }
-                    else if (Buffer[it] == '-') {
-                        throw std::runtime_error("Error: negative numbers in header!");
-                    }
-                    else {
-                        break;
-                    }
-                    it--;
-                }
-                if (number != -1)
-                    numbers.push_back(number);
-                if (numbers.size() == 4) {
-                    flag = 2;
-                }
-                Header.push_back('-');
-                continue;
-            }
-            Header.push_back(c);
-        }
-        if (flag == 1 && numbers.size() < 4) {
-            if (c == '\r' || c == '\n') {
-                flag = 0;
-            }
-        }
-    }
-
-    //PARSE HEADER
-    Type = numbers[0];
-    if ((Type != 5 && Type != 6) || Buffer[0] != 'P') {
-        throw std::runtime_error("Error: unable to read this file format!");
-    }
-    Width = numbers[1];
-    Height = numbers[2];
-    if (Width*Height*(Type - 4 + ((Type + 1) % 2)) != ImageData.size()) {
-        throw std::runtime_error("Error: Unexpected EOF!");
-    }
-    ColourDepth = numbers[3];
-    if (ColourDepth != 255) {
-        throw std::runtime_error("Error: unable to read this file format!");
-    }
+void PNMImage::Export(PNMFrameWriter& writer) {
+    settle();
+    writer.write(header(), ImageData.data(), ImageData.size());
 }
 
-void PNMImage::Export(const char* path) {
-    Buffer.clear();
-
-    Buffer.push_back('P');
-    Buffer.push_back(char(Type + '0'));
-    Buffer.push_back('\n');
-
-
-    std::string Width__ = std::to_string(Width);
-    std::string Height__ = std::to_string(Height);
-    std::string ColourDepth__ = std::to_string(ColourDepth);
-
-    for (auto c : Width__) {
-        Buffer.push_back(c);
-    }
-
-    Buffer.push_back(' ');
+void PNMImage::Invert() {
+    invertSamples(ImageData.data(), ImageData.size(), bytesPerSample(), ColourDepth, Channels, Alpha);
+}
 
-    for (auto c : Height__) {
-        Buffer.push_back(c);
-    }
+void PNMImage::Mirror(int direction) {
+    // 0 - horizontal
+    // 1 - vertical
+    Pending = Pending.then(Orientation::mirror(direction));
+}
 
-    Buffer.push_back('\n');
+void PNMImage::Rotate(int direction) {
+    // 0 - clockwise
+    // 1 - counterclockwise
+    Pending = Pending.then(Orientation::rotate(direction));
+    std::swap(Width, Height);
+}
 
-    for (auto c : ColourDepth__) {
-        Buffer.push_back(c);
-    }
+ImageView PNMImage::storedView(const Region& region) {
+    uint64_t width = Pending.Transpose ? Height : Width; // as the pixels are stored
+    uint64_t height = Pending.Transpose ? Width : Height;
+    ImageView whole(ImageData.data(), width, height, Channels, bytesPerSample());
+    return whole.sub(region.stored(Pending, Width, Height));
+}
 
-    Buffer.push_back('\n'); // fix 5 for mac ' '
+void PNMImage::Invert(const Region& region) {
+    invertView(storedView(region), ColourDepth, Alpha);
+}
 
-    for (auto c : ImageData) {
-        Buffer.push_back(c);
+void PNMImage::Mirror(int direction, const Region& region) {
+    if (region.isWhole()) {
+        Mirror(direction);
+        return;
     }
-
-    WriteBinary(path, Buffer);
+    // a flip of the rows of the image is a flip of the columns where it is stored transposed
+    mirrorView(storedView(region), Pending.Transpose ? 1 - direction : direction);
 }
 
-void PNMImage::Invert() {
-    for (auto & i : ImageData) {
-        i = ~i;
-    }
+void PNMImage::crop(const Region& region) {
+    // the pending orientation is kept and later moves the smaller image only
+    Region area = region.within(Width, Height);
+    ImageView view = storedView(area);
+    std::vector<byte> cropped(view.rowSize() * view.Height);
+    copyView(view, cropped.data());
+    ImageData = std::move(cropped);
+    Width = area.Width;
+    Height = area.Height;
 }
 
-void PNMImage::Mirror(int direction) {
-    // 0 - horizontal
-    // 1 - vertical
-    if (direction == 0) {
-        if (Type == 5) {
-            uint64_t i,j;
-            for (i = 0; i < Height; i++) {
-                for (j = 0; j < Width/2; j++) {
-                    std::swap(ImageData[i*Width + j], ImageData[i*Width + Width - 1 - j]);
-                }
-            }
-        } else {
-            uint64_t i,j;
-            for (i = 0; i < Height; i++) {
-                for (j = 0; j < Width*3/2; j+=3) {
-                    std::swap(ImageData[i*Width*3 + j], ImageData[i*Width*3 + Width*3 - j - 3]);
-                    std::swap(ImageData[i*Width*3 + j + 1], ImageData[i*Width*3 + Width*3 - j - 2]);
-                    std::swap(ImageData[i*Width*3 + j + 2], ImageData[i*Width*3 + Width*3 - j - 1]);
-                }
-            }
-        }
+void PNMImage::settle() {
+    if (Pending.isIdentity()) {
+        return;
     }
-    if (direction == 1) {
-        if (Type == 5) {
-            uint64_t i,j;
-            for (i = 0; i < Width; i++) {
-                for (j = 0; j < Height/2; j++) {
-                    std::swap(ImageData[j * Width + i], ImageData[(Height - 1 - j) * Width + i]);
-                }
-            }
-        } else {
-            uint64_t i,j;
-            for (i = 0; i < Width*3; i++) {
-                for (j = 0; j < Height/2; j++) {
-                    std::swap(ImageData[j * Width*3 + i], ImageData[(Height - 1 - j) * Width*3 + i]);
-                }
-            }
+    Orientation orientation = Pending;
+    Pending = Orientation();
+    uint64_t width = orientation.Transpose ? Height : Width; // as the pixels are stored
+    uint64_t height = orientation.Transpose ? Width : Height;
+    std::vector<byte> NewImageData;
+    if (orientation.Transpose) {
+        try {
+            NewImageData.resize(ImageData.size());
+        } catch (std::exception&) {
+            // not enough memory for a second image, the slower way needs none
         }
     }
+    if (NewImageData.empty()) {
+        orientInPlace(ImageData.data(), width, height, pixelSize(), orientation);
+        return;
+    }
+    orientPixels(ImageData.data(), NewImageData.data(), width, height, pixelSize(), orientation);
+    ImageData = std::move(NewImageData);
 }
 
-void PNMImage::Rotate(int direction) {
-    // 0 - clockwise
-    // 1 - counterclockwise
-    if (direction == 0) {
-        if (Type == 5) {
-            std::vector<byte> NewImageData;
-            uint64_t NewWidth, NewHeight;
-            NewHeight = Width;
-            NewWidth = Height;
-            try {
-                NewImageData.resize(Width * Height);
-            } catch (std::exception& e) {
-                char* error = nullptr;
-                strcat(error, "Memory error during rotation!\n");
-                strcat(error, e.what());
-                throw std::runtime_error(error);
-            }
-            for (uint64_t i = 0; i < Height; i++) {
-                for (uint64_t j = 0; j < Width; j++) {
-                    NewImageData[(NewWidth - i - 1) + j*NewWidth] = ImageData[i*Width + j];
-                }
-            }
-            Width = NewWidth;
-            Height = NewHeight;
-            ImageData = NewImageData;
-        } else {
-            std::vector<byte> NewImageData;
-            uint64_t NewWidth, NewHeight;
-            NewHeight = Width;
-            NewWidth = Height;
-            try {
-                NewImageData.resize(Width * Height * 3);
-            } catch (std::exception& e) {
-                char* error = nullptr;
-                strcat(error, "Memory error during rotation!\n");
-                strcat(error, e.what());
-                throw std::runtime_error(error);
-            }
-            for (uint64_t i = 0; i < Height; i++) {
-                for (uint64_t j = 0; j < Width; j++) {
-                    NewImageData[(NewWidth - i - 1)*3 + j*NewWidth*3] = ImageData[j*3 + Width*3*i];
-                    NewImageData[(NewWidth - i - 1)*3 + j*NewWidth*3 + 1] = ImageData[j*3 + Width*3*i + 1];
-                    NewImageData[(NewWidth - i - 1)*3 + j*NewWidth*3 + 2] = ImageData[j*3 + Width*3*i + 2];
-                }
-            }
-            Width = NewWidth;
-            Height = NewHeight;
-            ImageData = NewImageData;
-        }
-    }
-    if (direction == 1) {
-        if (Type == 5) {
-            std::vector<byte> NewImageData;
-            uint64_t NewWidth, NewHeight;
-            NewHeight = Width;
-            NewWidth = Height;
-            try {
-                NewImageData.resize(Width * Height);
-            } catch (std::exception& e) {
-                char* error = nullptr;
-                strcat(error, "Memory error during rotation!\n");
-                strcat(error, e.what());
-                throw std::runtime_error(error);
-            }
-            for (uint64_t i = 0; i < Height; i++) {
-                for (uint64_t j = 0; j < Width; j++) {
-                    NewImageData[j*NewWidth + i] = ImageData[(i + 1)*Width - 1 - j];
-                }
-            }
-            Width = NewWidth;
-            Height = NewHeight;
-            ImageData = NewImageData;
-        } else {
-            std::vector<byte> NewImageData;
-            uint64_t NewWidth, NewHeight;
-            NewHeight = Width;
-            NewWidth = Height;
-            try {
-                NewImageData.resize(Width * Height * 3);
-            } catch (std::exception& e) {
-                char* error = nullptr;
-                strcat(error, "Memory error during rotation!\n");
-                strcat(error, e.what());
-                throw std::runtime_error(error);
-            }
-            for (uint64_t i = 0; i < Height; i++) {
-                for (uint64_t j = 0; j < Width; j++) {
-                    NewImageData[(NewHeight - 1 - j)*NewWidth*3 + i*3] = ImageData[i*Width*3 + j*3];
-                    NewImageData[(NewHeight - 1 - j)*NewWidth*3 + i*3 + 1] = ImageData[i*Width*3 + j*3 + 1];
-                    NewImageData[(NewHeight - 1 - j)*NewWidth*3 + i*3 + 2] = ImageData[i*Width*3 + j*3 + 2];
-                }
-            }
-            Width = NewWidth;
-            Height = NewHeight;
-            ImageData = NewImageData;
-        }
-    }
+uint64_t PNMImage::bytesPerSample() const {
+    return ColourDepth > 255 ? 2 : 1;
+}
+
+uint64_t PNMImage::pixelSize() const {
+    return Channels * bytesPerSample();
 }
 
 bool PNMImage::isGrey() {
-    return Type == 5;
+    return Channels == 1 || (Channels == 2 && Alpha);
 }
 
 bool PNMImage::isColor() {
-    return Type == 6;
+    return Channels == 3 || (Channels == 4 && Alpha);
 }
 
-void PNMImage::drawPoint(int x, int y, double opacity, byte color, double gamma) { // видимо не умею считать вернул в развернутый вариант
+void PNMImage::drawPoint(int x, int y, double opacity, double lineColorLinear, const GammaTable& light) {
     opacity = std::max(std::min(opacity, 1.0), 0.0);
     if (y < 0 || y >= Height || x < 0 || x >= Width)
         return;
     if (opacity == 0) {
         return;
     }
-    if (gamma == 0) {
-        double lineColorSRGB = color / 255.0;
-        double lineColorLinear = lineColorSRGB <= 0.04045 ? lineColorSRGB / 12.92 : pow((lineColorSRGB + 0.055) / 1.055, 2.4);
-        double picColorSRGB = ImageData[Width * y + x] / 255.0;
-        double picColorLinear = picColorSRGB <= 0.04045 ? picColorSRGB / 12.92 : pow((picColorSRGB + 0.055) / 1.055, 2.4);
-        double c = (1 - opacity) * picColorLinear + opacity * lineColorLinear;
-        double cSRGB = c <= 0.0031308 ? 12.92 * c : 1.055 * pow(c, 1 / 2.4) - 0.055;
-        ImageData[Width * y + x] = 255 * cSRGB;
-    } else {
-        double lineColorGamma = color / 255.0;
-        double lineColorLinear = pow(lineColorGamma, gamma);
-        double picColorGamma = ImageData[Width * y + x] / 255.0;
-        double picColorLinear = pow(picColorGamma, gamma);
-        double c = (1 - opacity) * picColorLinear + opacity * lineColorLinear;
-        double cGamma = pow(c, 1.0 / gamma);
-        ImageData[Width * y + x] = 255 * cGamma;
-    }
+    double picColorLinear = light.decode(ImageData[Width * y + x]);
+    double c = (1 - opacity) * picColorLinear + opacity * lineColorLinear;
+    ImageData[Width * y + x] = light.encode(c);
 }
 
 void PNMImage::drawThickLine(double x0, double y0, double x1, double y1, byte color, double thiccness, double gamma) {
-    if (!isGrey()) {
+    settle();
+    if (Channels != 1) { // drawPoint takes a pixel for one sample
         throw std::runtime_error("Error: Incorrect color!");
     }
     if (thiccness <= 0)
@@ -364,12 +163,15 @@ void PNMImage::drawThickLine(double x0, double y0, double x1, double y1, byte co
     Point C = {end.x - vec.x, end.y - vec.y};
     Point D = {start.x - vec.x, start.y - vec.y};
     line = {A, B, C, D}; // vector line
+    // the samples are taken as bytes on the 0-255 scale, like color
+    const GammaTable& light = GammaTable::get(gamma, 255);
+    double lineColorLinear = GammaTable::decodeGamma(color / 255.0, gamma);
     // drawing raster line
     Point LT{std::min(std::min(A.x, B.x),std::min(C.x, D.x)), std::min(std::min(A.y, B.y),std::min(C.y, D.y))};
     Point RB{std::max(std::max(A.x, B.x),std::max(C.x, D.x)), std::max(std::max(A.y, B.y),std::max(C.y, D.y))};
     for (int x = (int)LT.x - 3; x <= RB.x + 3; x++) {
         for (int y = (int)LT.y - 3; y <= RB.y + 3; y++) {
-            drawPoint(x, y, opacity(x, y), color, gamma);
+            drawPoint(x, y, opacity(x, y), lineColorLinear, light);
         }
     }
 }
@@ -441,46 +243,90 @@ byte& PNMImage::pixel(int y, int x) {
     return ImageData[Width * y + x];
 }
 
-double PNMImage::decodeGamma(double value, double gamma) {
-    return gamma == 0 ? value <= 0.04045 ? value / 12.92 : pow((value + 0.055) / 1.055, 2.4) : pow(value, gamma);
-}
-
-double PNMImage::encodeGamma(double value, double gamma) {
-    return gamma == 0 ? value <= 0.0031308 ? 12.92 * value : 1.055 * pow(value, 1 / 2.4) - 0.055 : pow(value,
-                                                                                                       1.0 / gamma);
+void PNMImage::fillGradient(double gamma) {
+    settle();
+    fillGradientRows(ImageData.data(), Width, Channels, ColourDepth, Height, gamma);
 }
 
-void PNMImage::fillGradient(double gamma) {
-    for (int i = 0; i < Height; ++i) {
-        for (int j = 0; j < Width; ++j) {
-            pixel(i, j) = encodeGamma((double)j/(Width - 1.0), gamma)*255; // fix gradient 0-255 not 254
+void PNMImage::fillGradientRows(byte* rows, uint64_t width, uint64_t channels, uint64_t maxval, uint64_t count, double gamma) {
+    if (count == 0)
+        return;
+    withSample(maxval > 255 ? 2 : 1, [&](auto sample) {
+        using Sample = decltype(sample);
+        for (uint64_t j = 0; j < width; ++j) {
+            // fix gradient 0-255 not 254
+            Sample::store(rows + j * channels * Sample::Bytes, GammaTable::encodeGamma((double)j/(width - 1.0), gamma)*maxval);
+        }
+    });
+    // every row is the same, the curve is worked out for the first one only
+    uint64_t bytes = maxval > 255 ? 2 : 1;
+    uint64_t rowSize = width * channels * bytes;
+    for (uint64_t i = 1; i < count; ++i) {
+        if (channels == 1) {
+            std::memcpy(rows + i * rowSize, rows, rowSize);
+            continue;
+        }
+        // the alpha of every row stays its own
+        for (uint64_t j = 0; j < width; ++j) {
+            std::memcpy(rows + i * rowSize + j * channels * bytes, rows + j * channels * bytes, bytes);
         }
     }
 }
 
-double PNMImage::closestPaletteColor(byte px, byte bitRate) {
-    int t = bitRate;
-    byte result = px;
-    while (t < 8) {
+double PNMImage::closestPaletteColor(uint32_t px, byte bitRate, uint32_t bits) {
+    // the top bitRate bits repeated over all bits of the sample
+    uint32_t t = bitRate;
+    uint32_t result = px;
+    while (t < bits) {
         result = result>>bitRate;
-        result += (px>>(8-bitRate))<<(8-bitRate);
+        result += (px>>(bits-bitRate))<<(bits-bitRate);
         t += bitRate;
     }
     return result;
 }
 
-void PNMImage::ditherNone(byte bitRate, double gamma) {
-    for (int i = 0; i < Height; ++i) { // fix 1
-        for (int j = 0; j < Width; ++j) {
-            double value = decodeGamma(pixel(i, j)/255.0, gamma);
-            value = std::min(std::max(value, 0.0), 1.0);
-            double newPaletteColor = closestPaletteColor((byte)(value*255), bitRate);
-            pixel(i, j) = (byte)(encodeGamma(newPaletteColor/255, gamma)*255);
+template<typename Sample>
+double PNMImage::quantize(double value, byte bitRate, const GammaTable& light) {
+    // value is linear in [0, 1], the result is the stored sample in [0, maxval]
+    double newPaletteColor = closestPaletteColor((uint32_t)(value*Sample::Full), bitRate, Sample::Bytes * 8);
+    return light.encodeFull((uint32_t)newPaletteColor);
+}
+
+void PNMImage::ditherNone(byte bitRate, double gamma, const Region& region) {
+    // every pixel on its own, so the region is dithered where it is stored
+    ImageView view = storedView(region);
+    view.forEachRun([&](byte* rows, uint64_t firstRow, uint64_t count) {
+        ditherNoneRows(rows, view.Width, Channels, ColourDepth, firstRow, count, bitRate, gamma);
+    });
+}
+
+void PNMImage::ditherNoneRows(byte* rows, uint64_t width, uint64_t channels, uint64_t maxval, uint64_t, uint64_t count, byte bitRate, double gamma) {
+    const GammaTable& light = GammaTable::get(gamma, maxval);
+    withSample(maxval > 255 ? 2 : 1, [&](auto sample) {
+        using Sample = decltype(sample);
+        for (uint64_t i = 0; i < count; ++i) { // fix 1
+            for (uint64_t j = 0; j < width; ++j) {
+                byte* px = rows + (i * width + j) * channels * Sample::Bytes;
+                double value = light.decode(Sample::load(px));
+                value = std::min(std::max(value, 0.0), 1.0);
+                Sample::store(px, quantize<Sample>(value, bitRate, light));
+            }
         }
-    }
+    });
 }
 
-void PNMImage::ditherOrdered(byte bitRate, double gamma) {
+void PNMImage::ditherOrdered(byte bitRate, double gamma, const Region& region) {
+    settle();
+    Region area = region.within(Width, Height);
+    ImageView view = storedView(area);
+    view.forEachRun([&](byte* rows, uint64_t firstRow, uint64_t count) {
+        ditherOrderedRows(rows, view.Width, Channels, ColourDepth, area.Y + firstRow, count, bitRate, gamma, area.X);
+    });
+}
+
+void PNMImage::ditherOrderedRows(byte* rows, uint64_t width, uint64_t channels, uint64_t maxval, uint64_t firstRow, uint64_t count, byte bitRate, double gamma,
+                                 uint64_t firstColumn) {
+    const GammaTable& light = GammaTable::get(gamma, maxval);
     const double orderedMatrix[8][8] = {
             {1.0 / 64.0, 49.0 / 64.0, 13.0 / 64.0, 61.0 / 64.0, 4.0 / 64.0, 52.0 / 64.0, 16.0 / 64.0, 64.0 / 64.0},
             {33.0 / 64.0, 17.0 / 64.0, 45.0 / 64.0, 29.0 / 64.0, 36.0 / 64.0, 20.0 / 64.0, 48.0 / 64.0, 32.0 / 64.0},
@@ -491,188 +337,180 @@ void PNMImage::ditherOrdered(byte bitRate, double gamma) {
             {11.0 / 64.0, 59.0 / 64.0, 7.0 / 64.0, 55.0 / 64.0, 10.0 / 64.0, 58.0 / 64.0, 6.0 / 64.0, 54.0 / 64.0},
             {43.0 / 64.0, 27.0 / 64.0, 39.0 / 64.0, 23.0 / 64.0, 42.0 / 64.0, 26.0 / 64.0, 38.0 / 64.0, 22.0 / 64.0}
     };
-    for (int i = 0; i < Height; i++) {
-        for (int j = 0; j < Width; j++) {
-            double value = decodeGamma(pixel(i, j)/255.0, gamma);
-            value = value + (orderedMatrix[i % 8][j % 8] - 0.5) / bitRate;
-            value = std::min(std::max(value, 0.0), 1.0);
-            double newPaletteColor = closestPaletteColor((byte)(value*255), bitRate);
-            pixel(i, j) = (byte)(encodeGamma(newPaletteColor/255, gamma)*255);
+    withSample(maxval > 255 ? 2 : 1, [&](auto sample) {
+        using Sample = decltype(sample);
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t y = firstRow + i; // the matrix is anchored to the image, not to the band
+            for (uint64_t j = 0; j < width; j++) {
+                byte* px = rows + (i * width + j) * channels * Sample::Bytes;
+                double value = light.decode(Sample::load(px));
+                value = value + (orderedMatrix[y % 8][(firstColumn + j) % 8] - 0.5) / bitRate;
+                value = std::min(std::max(value, 0.0), 1.0);
+                Sample::store(px, quantize<Sample>(value, bitRate, light));
+            }
         }
-    }
+    });
 }
 
-void PNMImage::ditherRandom(byte bitRate, double gamma) {
+void PNMImage::ditherRandom(byte bitRate, double gamma, const Region& region) {
     std::random_device rd;
     std::mt19937 gen(rd());
-    for (int i = 0; i < Height; i++) {
-        for (int j = 0; j < Width; j++) {
-            double value = decodeGamma(pixel(i, j)/255.0, gamma);
-            double noise = (double)gen()/UINT32_MAX + 1e-7;
-            value = value + (noise - 0.5) / bitRate;
-            value = std::min(std::max(value, 0.0), 1.0);
-            double newPaletteColor = closestPaletteColor((byte)(value*255), bitRate);
-            pixel(i, j) = (byte)(encodeGamma(newPaletteColor/255, gamma)*255);
-        }
-    }
+    ImageView view = storedView(region);
+    const GammaTable& light = GammaTable::get(gamma, ColourDepth);
+    withSample(bytesPerSample(), [&](auto sample) {
+        using Sample = decltype(sample);
+        view.forEachRun([&](byte* rows, uint64_t, uint64_t count) {
+            for (uint64_t i = 0; i < count * view.Width; i++) {
+                byte* px = rows + i * view.Channels * Sample::Bytes;
+                double value = light.decode(Sample::load(px));
+                double noise = (double)gen()/UINT32_MAX + 1e-7;
+                value = value + (noise - 0.5) / bitRate;
+                value = std::min(std::max(value, 0.0), 1.0);
+                Sample::store(px, quantize<Sample>(value, bitRate, light));
+            }
+        });
+    });
 }
 
-void PNMImage::ditherFloydSteinberg(byte bitRate, double gamma) {
-    std::vector<double> errors(Height * Width, 0);
-    auto getError = [&](int h, int w) -> double& {
-        return errors[h * Width + w];
+void PNMImage::ditherErrorDiffusion(const double (&matrix)[3][5], byte bitRate, double gamma, const Region& region) {
+    settle();
+    // the error spreads within the region only
+    ImageView view = storedView(region);
+    // matrix[0][3..4] go to the right of the pixel, rows 1 and 2 to the next rows, centred on column 2
+    std::vector<double> errors(view.Height * view.Width, 0);
+    const GammaTable& light = GammaTable::get(gamma, ColourDepth);
+    auto getError = [&](uint64_t h, uint64_t w) -> double& {
+        return errors[h * view.Width + w];
     };
 
-    for (int i = 0; i < Height; i++) {
-        for (int j = 0; j < Width; j++) {
-            double value = decodeGamma(pixel(i, j)/255.0, gamma);
-            value = value + getError(i, j) / 255.0;
-            value = std::min(std::max(value, 0.0), 1.0);
+    withSample(bytesPerSample(), [&](auto sample) {
+        using Sample = decltype(sample);
+        for (uint64_t i = 0; i < view.Height; i++) {
+            for (uint64_t j = 0; j < view.Width; j++) {
+                byte* px = view.row(i) + j * view.Channels * Sample::Bytes;
+                // the error is kept on the 0..Full scale of the sample type
+                double current = Sample::load(px) * (double)Sample::Full / ColourDepth;
+                double value = light.decode(Sample::load(px));
+                value = value + getError(i, j) / Sample::Full;
+                value = std::min(std::max(value, 0.0), 1.0);
+
+                double newPaletteColor = closestPaletteColor((uint32_t)(value*Sample::Full), bitRate, Sample::Bytes * 8);
 
-            double newPaletteColor = closestPaletteColor((byte)(value*255), bitRate);
+                double error = current + getError(i, j) - newPaletteColor;
 
-            double error = pixel(i, j) + getError(i, j) - newPaletteColor;
+                Sample::store(px, light.encodeFull((uint32_t)newPaletteColor));
 
-            pixel(i, j) = (byte)(encodeGamma(newPaletteColor/255, gamma)*255);
+                for (uint64_t ie = 0; ie < 3; ie++) {
+                    for (uint64_t je = 0; je < 5; je++) {
+                        if (i + ie >= view.Height || j + je < 2 || j + je - 2 >= view.Width)
+                            continue; // fix 3
+                        if (ie == 0 && je <= 2)
+                            continue;
 
-            if (j + 1 < Width)
-                getError(i, j + 1) += error * 7.0 / 16.0;
-            if (i + 1 < Height && j + 1 < Width)
-                getError(i + 1, j + 1) += error * 1.0 / 16.0;
-            if (i + 1 < Height)
-                getError(i + 1, j) += error * 5.0 / 16.0;
-            if (i + 1 < Height && j - 1 >= 0)
-                getError(i + 1, j - 1) += error * 3.0 / 16.0;
+                        getError(i + ie, j + je - 2) += error * matrix[ie][je];
+                    }
+                }
+            }
         }
-    }
+    });
+}
+
+void PNMImage::ditherFloydSteinberg(byte bitRate, double gamma, const Region& region) {
+    const double matrixFloydSteinberg[3][5] = {
+            {0, 0, 0, 7.0 / 16.0, 0},
+            {0, 3.0 / 16.0, 5.0 / 16.0, 1.0 / 16.0, 0},
+            {0, 0, 0, 0, 0}
+    };
+    ditherErrorDiffusion(matrixFloydSteinberg, bitRate, gamma, region);
 }
 
-void PNMImage::ditherJJN(byte bitRate, double gamma) {
+void PNMImage::ditherJJN(byte bitRate, double gamma, const Region& region) {
     const double matrixJJN[3][5] = {
             {0, 0, 0, 7.0 / 48.0, 5.0 / 48.0},
             {3.0 / 48.0, 5.0 / 48.0, 7.0 / 48.0, 5.0 / 48.0, 3.0 / 48.0},
             {1.0 / 48.0, 3.0 / 48.0, 5.0 / 48.0, 3.0 / 48.0, 1.0 / 48.0}
     };
-
-    std::vector<double> errors(Height * Width, 0);
-    auto getError = [&](int h, int w) -> double& {
-        return errors[h * Width + w];
-    };
-
-    for (int i = 0; i < Height; i++) {
-        for (int j = 0; j < Width; j++) {
-            double value = decodeGamma(pixel(i, j)/255.0, gamma);
-            value = value + getError(i, j) / 255.0;
-            value = std::min(std::max(value, 0.0), 1.0);
-
-            double newPaletteColor = closestPaletteColor((byte)(value*255), bitRate);
-
-            double error = pixel(i, j) + getError(i, j) - newPaletteColor;
-
-            pixel(i, j) = (byte)(encodeGamma(newPaletteColor/255, gamma)*255);
-
-            for (int ie = 0; ie < 3; ie++) {
-                for (int je = 0; je < 5; je++) {
-                    if (i + ie >= Height || j + (je - 2) >= Width || j + (je - 2) < 0)
-                        continue; // fix 3
-                    if (ie == 0 && je < 3)
-                        continue;
-
-                    getError(i + ie, j + (je - 2)) += error * matrixJJN[ie][je];
-                }
-            }
-        }
-    }
+    ditherErrorDiffusion(matrixJJN, bitRate, gamma, region);
 }
 
-void PNMImage::ditherSierra(byte bitRate, double gamma) {
+void PNMImage::ditherSierra(byte bitRate, double gamma, const Region& region) {
     const double matrixSierra3[3][5] = {
             {0, 0, 0, 5.0 / 32.0, 3.0 / 32.0},
             {2.0 / 32.0, 4.0/ 32.0, 5.0 / 32.0, 4.0 / 32.0, 2.0 / 32.0},
             {0, 2.0 / 32.0, 3.0 / 32.0, 2.0 / 32.0, 0}
     };
-
-    std::vector<double> errors(Height * Width, 0);
-    auto getError = [&](int h, int w) -> double& {
-        return errors[h * Width + w];
-    };
-
-    for (int i = 0; i < Height; i++) {
-        for (int j = 0; j < Width; j++) {
-            double value = decodeGamma(pixel(i, j)/255.0, gamma);
-            value = value + getError(i, j) / 255.0;
-            value = std::min(std::max(value, 0.0), 1.0);
-
-            double newPaletteColor = closestPaletteColor((byte)(value*255), bitRate);
-
-            double error = pixel(i, j) + getError(i, j) - newPaletteColor;
-
-            pixel(i, j) = (byte)(encodeGamma(newPaletteColor/255, gamma)*255);
-
-            for (int ie = 0; ie < 3; ie++) {
-                for (int je = 0; je < 5; je++) {
-                    if (i + ie >= Height || j + (je - 2) >= Width || j + (je - 2) < 0)
-                        continue; // fix 3
-                    if (ie == 0 && je <= 2)
-                        continue;
-
-                    getError(i + ie, j + (je - 2)) += error * matrixSierra3[ie][je];
-                }
-            }
-        }
-    }
+    ditherErrorDiffusion(matrixSierra3, bitRate, gamma, region);
 }
 
-void PNMImage::ditherAtkinson(byte bitRate, double gamma) {
-    const int matrixAtkinson[3][5] = {
-            {0, 0, 0, 1, 1},
-            {0, 1, 1, 1, 0},
-            {0, 0, 1, 0, 0}
-    };
-
-    std::vector<double> errors(Height * Width, 0);
-    auto getError = [&](int h, int w) -> double& {
-        return errors[h * Width + w];
+void PNMImage::ditherAtkinson(byte bitRate, double gamma, const Region& region) {
+    const double matrixAtkinson[3][5] = {
+            {0, 0, 0, 1.0 / 8.0, 1.0 / 8.0},
+            {0, 1.0 / 8.0, 1.0 / 8.0, 1.0 / 8.0, 0},
+            {0, 0, 1.0 / 8.0, 0, 0}
     };
+    ditherErrorDiffusion(matrixAtkinson, bitRate, gamma, region);
+}
 
-    for (int i = 0; i < Height; i++) {
-        for (int j = 0; j < Width; j++) {
-            double value = decodeGamma(pixel(i, j)/255.0, gamma);
-            value = value + getError(i, j) / 255.0;
-            value = std::min(std::max(value, 0.0), 1.0);
-
-            double newPaletteColor = closestPaletteColor((byte)(value*255), bitRate);
-
-            double error = pixel(i, j) + getError(i, j) - newPaletteColor;
-
-            pixel(i, j) = (byte)(encodeGamma(newPaletteColor/255, gamma)*255);
-
-            for (int ie = 0; ie < 3; ie++) {
-                for (int je = 0; je < 5; je++) {
-                    if (i + ie >= Height || j + (je - 2) >= Width || j + (je - 2) < 0)
-                        continue; // fix 3
-                    if (ie == 0 && je <= 2)
-                        continue;
-
-                    getError(i + ie, j + (je - 2)) += error * matrixAtkinson[ie][je] / 8.0;
-                }
-            }
-        }
-    }
+void PNMImage::ditherHalftone(byte bitRate, double gamma, const Region& region) {
+    settle();
+    Region area = region.within(Width, Height);
+    ImageView view = storedView(area);
+    view.forEachRun([&](byte* rows, uint64_t firstRow, uint64_t count) {
+        ditherHalftoneRows(rows, view.Width, Channels, ColourDepth, area.Y + firstRow, count, bitRate, gamma, area.X);
+    });
 }
 
-void PNMImage::ditherHalftone(byte bitRate, double gamma) {
+void PNMImage::ditherHalftoneRows(byte* rows, uint64_t width, uint64_t channels, uint64_t maxval, uint64_t firstRow, uint64_t count, byte bitRate, double gamma,
+                                  uint64_t firstColumn) {
+    const GammaTable& light = GammaTable::get(gamma, maxval);
     const double halftoneMatrix[4][4] = {7 / 17.0, 13 / 17.0, 11 / 17.0, 4 / 17.0, // fix 2
                                          12 / 17.0, 16 / 17.0, 14 / 17.0, 8 / 17.0,
                                          10 / 17.0, 15 / 17.0, 6 / 17.0, 2 / 17.0,
                                          5 / 17.0, 9 / 17.0, 3 / 17.0, 1 / 17.0};
-    for (int i = 0; i < Height; i++) {
-        for (int j = 0; j < Width; j++) {
-            double value = decodeGamma(pixel(i, j)/255.0, gamma);
-            value = value + (halftoneMatrix[i % 4][j % 4] - 0.5) / bitRate;
-            value = std::min(std::max(value, 0.0), 1.0);
-            double newPaletteColor = closestPaletteColor((byte)(value*255), bitRate);
-            pixel(i, j) = (byte)(encodeGamma(newPaletteColor/255, gamma)*255);
+    withSample(maxval > 255 ? 2 : 1, [&](auto sample) {
+        using Sample = decltype(sample);
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t y = firstRow + i;
+            for (uint64_t j = 0; j < width; j++) {
+                byte* px = rows + (i * width + j) * channels * Sample::Bytes;
+                double value = light.decode(Sample::load(px));
+                value = value + (halftoneMatrix[y % 4][(firstColumn + j) % 4] - 0.5) / bitRate;
+                value = std::min(std::max(value, 0.0), 1.0);
+                Sample::store(px, quantize<Sample>(value, bitRate, light));
+            }
         }
+    });
+}
+
+void PNMImage::streamDither(const char* input, const char* output, uint64_t bandRows, bool gradient,
+                            int ditheringType, byte bitRate, double gamma) {
+    // only dithers that look at one pixel at a time can run band by band
+    if (ditheringType != 0 && ditheringType != 1 && ditheringType != 7) {
+        throw std::runtime_error("Error: this dithering type can not be streamed!");
     }
-}
\ No newline at end of file
+    streamRows(input, output, bandRows, [&](const PNMHeader& header, byte* rows, uint64_t firstRow, uint64_t count) {
+        uint64_t channels = header.channels();
+        if (channels != 1 && !(channels == 2 && header.hasAlpha())) {
+            throw std::runtime_error("Error: unable to read this file format!");
+        }
+        uint64_t maxval = header.ColourDepth;
+        if (gradient) fillGradientRows(rows, header.Width, channels, maxval, count, gamma);
+        switch (ditheringType) {
+            case 0: {
+                ditherNoneRows(rows, header.Width, channels, maxval, firstRow, count, bitRate, gamma);
+                break;
+            }
+            case 1: {
+                ditherOrderedRows(rows, header.Width, channels, maxval, firstRow, count, bitRate, gamma);
+                break;
+            }
+            case 7: {
+                ditherHalftoneRows(rows, header.Width, channels, maxval, firstRow, count, bitRate, gamma);
+                break;
+            }
+            default: {
+
+            }
+        }
+    });
+}
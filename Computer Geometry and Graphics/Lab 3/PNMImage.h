@@ -2,9 +2,15 @@
 #define LAB_2_PNMIMAGE_H
 
 #include <vector>
+#include <string>
 #include <cstdint>
 #include <iostream>
 #include <fstream>
+#include "PixelBuffer.h"
+#include "PNMStream.h"
+#include "PixelKernels.h"
+#include "ImageView.h"
+#include "GammaTable.h"
 
 using byte = unsigned char;
 
@@ -19,62 +25,110 @@ private:
         Point A, B, C, D;
     };
 
-    std::vector<byte> Buffer;
-    std::vector<byte> ImageData;
+    PixelBuffer ImageData;
     uint64_t Size, Width, Height, ColourDepth;
+    uint64_t Channels;     // 1 for P5, 3 for P6, DEPTH for P7
+    std::string TupleType; // P7 only
+    bool Alpha;            // the last channel is alpha
     uint8_t Type;
+    // Mirror and Rotate calls not applied to the pixels yet, Width and Height already follow them.
+    // Operations that treat every pixel alike (Invert, ditherNone, ditherRandom) leave it pending.
+    Orientation Pending;
     struct Point start, end;
     struct Rect line;
 
-    void drawPoint(int, int, double, byte, double);
+    // moves the pixels once for every pending Mirror and Rotate
+    void settle();
+
+    // the pixels of region as they are stored, Pending is not applied to them
+    ImageView storedView(const Region& region);
+
+    // blends the line colour, linear, over pixel (x, y) with opacity
+    void drawPoint(int x, int y, double opacity, double lineColorLinear, const GammaTable& light);
 
     double opacity(double x, double y);
 
     byte& pixel(int, int);
 
-    static double closestPaletteColor(byte px, byte bitRate);
+    static double closestPaletteColor(uint32_t px, byte bitRate, uint32_t bits = 8);
+
+    // the palette colour for a linear value, gamma encoded and scaled to maxval through light
+    template<typename Sample>
+    static double quantize(double value, byte bitRate, const GammaTable& light);
+
+    // The Rows kernels work on 8- or 16-bit samples, picked by maxval. A pixel is channels samples,
+    // the grey one first and an alpha one after it that is left as it is.
+    static void fillGradientRows(byte* rows, uint64_t width, uint64_t channels, uint64_t maxval, uint64_t count, double gamma);
 
-    static double decodeGamma(double value, double gamma);
+    static void ditherNoneRows(byte* rows, uint64_t width, uint64_t channels, uint64_t maxval, uint64_t firstRow, uint64_t count, byte bitRate, double gamma);
 
-    static double encodeGamma(double value, double gamma);
+    // firstRow and firstColumn anchor the matrix to the image when rows is a part of it
+    static void ditherOrderedRows(byte* rows, uint64_t width, uint64_t channels, uint64_t maxval, uint64_t firstRow, uint64_t count, byte bitRate, double gamma,
+                                  uint64_t firstColumn = 0);
+
+    static void ditherHalftoneRows(byte* rows, uint64_t width, uint64_t channels, uint64_t maxval, uint64_t firstRow, uint64_t count, byte bitRate, double gamma,
+                                   uint64_t firstColumn = 0);
+
+    void ditherErrorDiffusion(const double (&matrix)[3][5], byte bitRate, double gamma, const Region& region);
 public:
     void fillGradient(double);
 
-    static std::vector<byte> ReadBinary(const char*, uint64_t);
-
-    static void WriteBinary(const char*, const std::vector<byte>&);
+    // One image of a multi-image file, the payload stays where the reader found it.
+    explicit PNMImage(PNMFrame&& frame);
 
-    explicit PNMImage(const char*);
+    [[nodiscard]] PNMHeader header() const;
 
-    void Export(const char*);
+    // Appends the image to a multi-image output.
+    void Export(PNMFrameWriter& writer);
 
     void Invert();
 
+    // inverts region only, it is found where the pixels are stored so a pending Mirror or Rotate stays pending
+    void Invert(const Region& region);
+
     void Mirror(int);
 
+    // mirrors the pixels within region, the rest of the image stays where it is
+    void Mirror(int direction, const Region& region);
+
+    // keeps region only, the pixels outside it are never read
+    void crop(const Region& region);
+
     void Rotate(int direction);
 
+    // 2 when maxval is above 255, samples are then stored big-endian
+    [[nodiscard]] uint64_t bytesPerSample() const;
+
+    [[nodiscard]] uint64_t pixelSize() const;
+
+    // grey or RGB samples, either may carry an alpha channel after them
     bool isGrey();
 
     bool isColor();
 
     void drawThickLine(double, double, double, double, byte, double, double);
 
-    void ditherNone(byte bitRate, double gamma);
+    // The dithers work on region only, the whole image by default. The error of the error diffusion
+    // dithers stays within the region, the matrices of ordered and halftone stay anchored to the image.
+    void ditherNone(byte bitRate, double gamma, const Region& region = Region());
+
+    void ditherOrdered(byte bitRate, double gamma, const Region& region = Region());
 
-    void ditherOrdered(byte bitRate, double gamma);
+    void ditherRandom(byte bitRate, double gamma, const Region& region = Region());
 
-    void ditherRandom(byte bitRate, double gamma);
+    void ditherFloydSteinberg(byte bitRate, double gamma, const Region& region = Region());
 
-    void ditherFloydSteinberg(byte bitRate, double gamma);
+    void ditherJJN(byte bitRate, double gamma, const Region& region = Region());
 
-    void ditherJJN(byte bitRate, double gamma);
+    void ditherSierra(byte bitRate, double gamma, const Region& region = Region());
 
-    void ditherSierra(byte bitRate, double gamma);
+    void ditherAtkinson(byte bitRate, double gamma, const Region& region = Region());
 
-    void ditherAtkinson(byte bitRate, double gamma);
+    void ditherHalftone(byte bitRate, double gamma, const Region& region = Region());
 
-    void ditherHalftone(byte bitRate, double gamma);
+    // Gradient and the point dithers (0, 1, 7) read and write the image bandRows rows at a time.
+    static void streamDither(const char* input, const char* output, uint64_t bandRows, bool gradient,
+                             int ditheringType, byte bitRate, double gamma);
 };
 
 
@@ -0,0 +1,445 @@
+#include "PNMStream.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#else
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+bool isStandardStream(const char* path) {
+    return std::strcmp(path, "-") == 0;
+}
+
+namespace {
+    // stdin and stdout carry raw bytes, Windows would translate line ends otherwise
+    void binaryMode(FILE* file) {
+#ifdef _WIN32
+        _setmode(_fileno(file), _O_BINARY);
+#else
+        (void)file;
+#endif
+    }
+}
+
+PNMReader::PNMReader(const char* path) : Stream(&std::cin) {
+    if (isStandardStream(path)) {
+        binaryMode(stdin);
+    } else {
+        File.open(path, std::ios::binary);
+        if (!File) {
+            throw std::runtime_error("Error when opening file.");
+        }
+        Stream = &File;
+    }
+    Header = PNMHeader::read(*Stream);
+}
+
+const PNMHeader& PNMReader::header() const {
+    return Header;
+}
+
+uint64_t PNMReader::readRows(byte* rows, uint64_t count) {
+    count = std::min(count, Header.Height - RowsRead);
+    uint64_t length = count * Header.rowSize();
+    Stream->read(reinterpret_cast<char*>(rows), length);
+    if ((uint64_t)Stream->gcount() != length) {
+        throw std::runtime_error("Error: Unexpected EOF!");
+    }
+    RowsRead += count;
+    return count;
+}
+
+bool PNMReader::nextFrame() {
+    if (RowsRead != Header.Height) {
+        throw std::runtime_error("Error: image was not read completely!");
+    }
+    while (Stream->peek() != EOF && std::isspace(Stream->peek())) {
+        Stream->get();
+    }
+    if (Stream->peek() == EOF) {
+        return false;
+    }
+    Header = PNMHeader::read(*Stream);
+    RowsRead = 0;
+    return true;
+}
+
+PNMWriter::PNMWriter(const char* path, const PNMHeader& header) : Stream(&std::cout), Header(header) {
+    if (isStandardStream(path)) {
+        binaryMode(stdout);
+    } else {
+        File.open(path, std::ios::binary);
+        if (!File) {
+            throw std::runtime_error("Error creating output file!");
+        }
+        Stream = &File;
+    }
+    std::string text = Header.format();
+    Stream->write(text.data(), text.size());
+}
+
+void PNMWriter::writeRows(const byte* rows, uint64_t count) {
+    if (RowsWritten + count > Header.Height) {
+        throw std::runtime_error("Error: too many rows for the image!");
+    }
+    Stream->write(reinterpret_cast<const char*>(rows), count * Header.rowSize());
+    if (!*Stream) {
+        throw std::runtime_error("Writing error, file could not be written properly!");
+    }
+    RowsWritten += count;
+}
+
+void PNMWriter::nextFrame(const PNMHeader& header) {
+    if (RowsWritten != Header.Height) {
+        throw std::runtime_error("Error: image was not written completely!");
+    }
+    Header = header;
+    RowsWritten = 0;
+    std::string text = Header.format();
+    Stream->write(text.data(), text.size());
+}
+
+void PNMWriter::finish() {
+    if (RowsWritten != Header.Height) {
+        throw std::runtime_error("Error: image was not written completely!");
+    }
+    Stream->flush();
+    if (!*Stream) {
+        throw std::runtime_error("Writing error, file could not be written properly!");
+    }
+    if (File.is_open()) {
+        File.close();
+    }
+}
+
+void streamRows(const char* input, const char* output, uint64_t bandRows, const RowKernel& kernel) {
+    std::error_code ec{};
+    if (std::filesystem::equivalent(input, output, ec)) {
+        throw std::runtime_error("Error: can not stream an image into itself!");
+    }
+    PNMReader reader(input);
+    PNMWriter writer(output, reader.header());
+    std::vector<byte> band;
+    bool first = true;
+    do {
+        const PNMHeader& header = reader.header();
+        if (!first) {
+            writer.nextFrame(header);
+        }
+        first = false;
+        uint64_t rows = std::max<uint64_t>(1, std::min(bandRows, header.Height));
+        band.resize(rows * header.rowSize());
+        uint64_t row = 0;
+        while (row < header.Height) {
+            uint64_t count = reader.readRows(band.data(), rows);
+            kernel(header, band.data(), row, count);
+            writer.writeRows(band.data(), count);
+            row += count;
+        }
+    } while (reader.nextFrame());
+    writer.finish();
+}
+
+std::vector<PNMProbe> PNMProbe::read(const char* path) {
+    std::ifstream file;
+    std::istream* stream = &std::cin;
+    if (isStandardStream(path)) {
+        binaryMode(stdin);
+    } else {
+        file.open(path, std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("Error when opening file.");
+        }
+        stream = &file;
+    }
+    // a regular file is seeked over, a pipe has no size and is read through
+    std::error_code ec{};
+    uint64_t size = file.is_open() ? std::filesystem::file_size(path, ec) : 0;
+    bool seekable = file.is_open() && ec == std::error_code{};
+
+    std::vector<PNMProbe> probes;
+    uint64_t offset = 0;
+    while (true) {
+        if (!probes.empty()) {
+            while (stream->peek() != EOF && std::isspace(stream->peek())) {
+                stream->get();
+                offset++;
+            }
+            if (stream->peek() == EOF) {
+                break;
+            }
+        }
+        PNMProbe probe;
+        probe.Offset = offset;
+        probe.Header = PNMHeader::read(*stream);
+        uint64_t start = offset + probe.Header.DataOffset;
+        if (seekable) {
+            probe.Available = std::min(probe.Header.DataSize, size > start ? size - start : 0);
+            stream->seekg(start + probe.Available);
+        } else {
+            const uint64_t chunk = 1ull << 30;
+            while (probe.Available < probe.Header.DataSize) {
+                uint64_t wanted = std::min(chunk, probe.Header.DataSize - probe.Available);
+                stream->ignore(wanted);
+                probe.Available += stream->gcount();
+                if ((uint64_t)stream->gcount() != wanted) {
+                    break;
+                }
+            }
+        }
+        offset = start + probe.Available;
+        probes.push_back(probe);
+        if (!probe.complete()) {
+            break;
+        }
+    }
+    return probes;
+}
+
+int probeFiles(int count, char** paths) {
+    int result = 0;
+    for (int i = 0; i < count; i++) {
+        try {
+            std::vector<PNMProbe> probes = PNMProbe::read(paths[i]);
+            for (uint64_t k = 0; k < probes.size(); k++) {
+                const PNMHeader& header = probes[k].Header;
+                std::cout << paths[i] << '\t' << k << "\tP" << (int)header.Type << '\t'
+                          << header.Width << '\t' << header.Height << '\t' << header.channels() << '\t'
+                          << header.ColourDepth << '\t' << (header.TupleType.empty() ? "-" : header.TupleType) << '\t'
+                          << header.DataSize << '\t' << (probes[k].complete() ? "ok" : "truncated") << '\n';
+                if (!probes[k].complete()) {
+                    result = 1;
+                }
+            }
+        } catch (std::exception& e) {
+            std::cerr << paths[i] << ": " << e.what() << std::endl;
+            result = 1;
+        }
+    }
+    std::cout.flush();
+    return result;
+}
+
+PNMFrameReader::PNMFrameReader(const char* path) {
+    if (isStandardStream(path)) {
+        binaryMode(stdin);
+        Stream = &std::cin;
+    } else {
+        File = std::make_shared<MappedFile>(path);
+    }
+}
+
+bool PNMFrameReader::next(PNMFrame& frame) {
+    if (Stream) {
+        if (Started) {
+            while (Stream->peek() != EOF && std::isspace(Stream->peek())) {
+                Stream->get();
+            }
+            if (Stream->peek() == EOF) {
+                return false;
+            }
+        }
+        Started = true;
+        PNMHeader header = PNMHeader::read(*Stream);
+        std::vector<byte> data(header.DataSize);
+        Stream->read(reinterpret_cast<char*>(data.data()), header.DataSize);
+        if ((uint64_t)Stream->gcount() != header.DataSize) {
+            throw std::runtime_error("Error: Unexpected EOF!");
+        }
+        frame.Header = header;
+        frame.Data = std::move(data);
+        return true;
+    }
+    const byte* data = File->data();
+    uint64_t size = File->size();
+    if (Offset > 0) {
+        while (Offset < size && std::isspace(data[Offset])) {
+            Offset++;
+        }
+        if (Offset == size) {
+            return false;
+        }
+    }
+    PNMHeader header = PNMHeader::parse(data + Offset, size - Offset);
+    if (header.DataSize > size - Offset - header.DataOffset) {
+        throw std::runtime_error("Error: Unexpected EOF!");
+    }
+    frame.Header = header;
+    frame.Data = PixelBuffer(File, Offset + header.DataOffset, header.DataSize);
+    Offset += header.DataOffset + header.DataSize;
+    return true;
+}
+
+bool PNMFrameReader::isSource(const char* path) const {
+    if (!File) {
+        return false;
+    }
+    std::error_code ec{};
+    return std::filesystem::equivalent(File->path(), path, ec);
+}
+
+PNMFrameWriter::PNMFrameWriter(const char* path, bool atomic)
+        : Target(path), Temp(path), Atomic(atomic && !isStandardStream(path)), Pipe(isStandardStream(path)) {}
+
+void PNMFrameWriter::open() {
+    Opened = true;
+#ifndef _WIN32
+    if (Pipe) {
+        Descriptor = STDOUT_FILENO;
+        return;
+    }
+    if (Atomic) {
+        std::vector<char> name(Target.begin(), Target.end());
+        for (char c : std::string(".XXXXXX")) name.push_back(c);
+        name.push_back('\0');
+        Descriptor = mkstemp(name.data());
+        if (Descriptor >= 0) {
+            mode_t mask = umask(0);
+            umask(mask);
+            fchmod(Descriptor, 0666 & ~mask);
+            Temp = name.data();
+        }
+    } else {
+        Descriptor = ::open(Target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+    if (Descriptor < 0) {
+        throw std::runtime_error("Error creating output file!");
+    }
+#else
+    if (Pipe) {
+        binaryMode(stdout);
+        Stream = &std::cout;
+        return;
+    }
+    if (Atomic) {
+        Temp = Target + ".tmp";
+    }
+    File.open(Temp, std::ios::binary);
+    if (!File) {
+        throw std::runtime_error("Error creating output file!");
+    }
+    Stream = &File;
+#endif
+}
+
+int PNMFrameWriter::release() {
+    // stdout stays open for whoever else writes to it
+#ifndef _WIN32
+    int result = Descriptor >= 0 && !Pipe ? close(Descriptor) : 0;
+    Descriptor = -1;
+    return result;
+#else
+    if (Pipe) {
+        Stream->flush();
+        return *Stream ? 0 : -1;
+    }
+    File.close();
+    return File ? 0 : -1;
+#endif
+}
+
+PNMFrameWriter::~PNMFrameWriter() {
+    if (Opened && !Finished) {
+        release();
+        if (Atomic) {
+            std::error_code ec{};
+            std::filesystem::remove(Temp, ec);
+        }
+    }
+}
+
+void PNMFrameWriter::fail(const char* message) {
+    release();
+    if (Atomic) {
+        std::error_code ec{};
+        std::filesystem::remove(Temp, ec);
+    }
+    Finished = true;
+    throw std::runtime_error(message);
+}
+
+void PNMFrameWriter::write(const PNMHeader& header, const byte* data, uint64_t size) {
+    if (Finished) {
+        throw std::runtime_error("Error: output file is already finished!");
+    }
+    if (!Opened) {
+        open();
+    }
+    std::string text = header.format();
+#ifndef _WIN32
+    iovec parts[2] = {{text.data(), text.size()}, {const_cast<byte*>(data), size}};
+    iovec* part = parts;
+    int left = 2;
+    while (left > 0) {
+        ssize_t written = writev(Descriptor, part, left);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            fail("Writing error, file could not be written properly!");
+        }
+        // a partial write leaves us somewhere inside one of the parts
+        while (left > 0 && (uint64_t)written >= part->iov_len) {
+            written -= part->iov_len;
+            part++;
+            left--;
+        }
+        if (left > 0) {
+            part->iov_base = static_cast<char*>(part->iov_base) + written;
+            part->iov_len -= written;
+        }
+    }
+#else
+    Stream->write(text.data(), text.size());
+    Stream->write(reinterpret_cast<const char*>(data), size);
+    if (!*Stream) {
+        fail("Writing error, file could not be written properly!");
+    }
+#endif
+}
+
+void PNMFrameWriter::finish() {
+    if (Finished) {
+        return;
+    }
+    if (!Opened) {
+        open();
+    }
+#ifndef _WIN32
+    if (Atomic && fsync(Descriptor) != 0) {
+        fail("Writing error, file could not be written properly!");
+    }
+#endif
+    if (release() != 0) {
+        fail("Writing error, file could not be written properly!");
+    }
+    Finished = true;
+    if (Atomic) {
+        std::error_code ec{};
+        std::filesystem::rename(Temp, Target, ec);
+        if (ec != std::error_code{}) {
+            std::filesystem::remove(Temp, ec);
+            throw std::runtime_error("Writing error, file could not be renamed into place!");
+        }
+    }
+}
+
+void writeImage(const char* path, const PNMHeader& header, const byte* data, uint64_t size, bool atomic) {
+    PNMFrameWriter writer(path, atomic);
+    writer.write(header, data, size);
+    writer.finish();
+}
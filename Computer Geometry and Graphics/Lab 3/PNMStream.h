@@ -0,0 +1,156 @@
+#ifndef LAB_1_PNMSTREAM_H
+#define LAB_1_PNMSTREAM_H
+
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "PNMHeader.h"
+#include "PixelBuffer.h"
+
+using byte = unsigned char;
+
+// "-" names stdin as an input and stdout as an output.
+bool isStandardStream(const char* path);
+
+// Reads a PNM image a few rows at a time, the payload is never held as a whole.
+class PNMReader {
+private:
+    std::ifstream File;
+    std::istream* Stream;
+    PNMHeader Header;
+    uint64_t RowsRead = 0;
+
+public:
+    explicit PNMReader(const char* path);
+
+    [[nodiscard]] const PNMHeader& header() const;
+
+    // Fills rows with up to count rows, returns how many were left to read.
+    uint64_t readRows(byte* rows, uint64_t count);
+
+    // Moves on to the image that follows the current one, which must be read completely.
+    // Returns false when only whitespace is left.
+    bool nextFrame();
+};
+
+// Writes a PNM image a few rows at a time.
+class PNMWriter {
+private:
+    std::ofstream File;
+    std::ostream* Stream;
+    PNMHeader Header;
+    uint64_t RowsWritten = 0;
+
+public:
+    PNMWriter(const char* path, const PNMHeader& header);
+
+    void writeRows(const byte* rows, uint64_t count);
+
+    // Starts another image right after the current one, which must be written completely.
+    void nextFrame(const PNMHeader& header);
+
+    void finish();
+};
+
+// One image of a file that may hold several back to back.
+struct PNMFrame {
+    PNMHeader Header;
+    PixelBuffer Data;
+};
+
+// Walks the images of a mapped file in order, each payload is a view into the mapping.
+// stdin is read one image at a time instead, its size is never needed.
+class PNMFrameReader {
+private:
+    std::shared_ptr<MappedFile> File;
+    std::istream* Stream = nullptr;
+    uint64_t Offset = 0;
+    bool Started = false;
+
+public:
+    explicit PNMFrameReader(const char* path);
+
+    // Fills frame with the next image, returns false when only whitespace is left.
+    // The first call always reads an image.
+    bool next(PNMFrame& frame);
+
+    // Whether path is the file being read, writing over it needs a temporary file.
+    [[nodiscard]] bool isSource(const char* path) const;
+};
+
+// Writes whole images one after another into one file.
+// With atomic the file is written next to path under a temporary name and renamed into place by finish.
+// stdout is written as it is, atomic does not apply to it.
+class PNMFrameWriter {
+private:
+    std::string Target, Temp;
+    bool Atomic;
+    bool Pipe;
+    bool Opened = false; // the file is created by the first write, so a bad input leaves no output behind
+    bool Finished = false;
+#ifndef _WIN32
+    int Descriptor = -1;
+#else
+    std::ofstream File;
+    std::ostream* Stream = nullptr;
+#endif
+
+    void open();
+
+    // closes the file, returns non-zero when that failed
+    int release();
+
+    void fail(const char* message);
+
+public:
+    PNMFrameWriter(const char* path, bool atomic = false);
+
+    PNMFrameWriter(const PNMFrameWriter& other) = delete;
+
+    PNMFrameWriter& operator=(const PNMFrameWriter& other) = delete;
+
+    ~PNMFrameWriter();
+
+    // Header and payload go out with one scatter write, no copy of the image.
+    void write(const PNMHeader& header, const byte* data, uint64_t size);
+
+    void finish();
+};
+
+// What the header of one image promises, read without touching its pixels.
+struct PNMProbe {
+    PNMHeader Header;
+    uint64_t Offset = 0;    // where the image starts in the file
+    uint64_t Available = 0; // payload bytes the file really holds, at most Header.DataSize
+
+    [[nodiscard]] bool complete() const { return Available == Header.DataSize; }
+
+    // Reads the header of every image in path and seeks over the payloads,
+    // so only the header bytes are read from a regular file. A truncated image ends the list.
+    static std::vector<PNMProbe> read(const char* path);
+};
+
+// Prints a tab separated line for every image of every file:
+// path, image number, type, width, height, depth, maxval, tuple type, payload size, ok or truncated.
+// Returns 1 when a file could not be probed or is truncated, 0 otherwise.
+int probeFiles(int count, char** paths);
+
+// kernel(header, rows, firstRow, count) changes one band of rows in place.
+using RowKernel = std::function<void(const PNMHeader&, byte*, uint64_t, uint64_t)>;
+
+// Pipes the image at input through kernel into output, bandRows rows at a time,
+// so memory use depends on the width only. Every image of a multi-image file goes
+// through kernel in turn, firstRow counts from the top of each.
+void streamRows(const char* input, const char* output, uint64_t bandRows, const RowKernel& kernel);
+
+// Writes header and payload straight from data with one scatter write, no copy of the image.
+// With atomic the file is written next to path under a temporary name and renamed into place.
+void writeImage(const char* path, const PNMHeader& header, const byte* data, uint64_t size, bool atomic = false);
+
+
+#endif
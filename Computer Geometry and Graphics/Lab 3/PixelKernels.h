@@ -0,0 +1,95 @@
+#ifndef LAB_1_PIXELKERNELS_H
+#define LAB_1_PIXELKERNELS_H
+
+#include <cstdint>
+
+using byte = unsigned char;
+
+// Samples are kept the way PNM stores them: one byte up to maxval 255,
+// two bytes big-endian above that.
+struct Sample8 {
+    static const uint64_t Bytes = 1;
+    static const uint32_t Full = 255;
+
+    static uint32_t load(const byte* p) { return p[0]; }
+    static void store(byte* p, uint32_t value) { p[0] = value; }
+};
+
+struct Sample16 {
+    static const uint64_t Bytes = 2;
+    static const uint32_t Full = 65535;
+
+    static uint32_t load(const byte* p) { return (uint32_t(p[0]) << 8) | p[1]; }
+    static void store(byte* p, uint32_t value) { p[0] = value >> 8; p[1] = value & 0xFF; }
+};
+
+// Calls f(Sample8{}) or f(Sample16{}), so a kernel is compiled once per sample size.
+template<typename F>
+void withSample(uint64_t bytesPerSample, F&& f) {
+    if (bytesPerSample == 2) {
+        f(Sample16{});
+    } else {
+        f(Sample8{});
+    }
+}
+
+// One of the eight symmetries of a rectangle (the dihedral group D4): the pixels are
+// transposed first when Transpose is set, then the columns (FlipX) and the rows (FlipY) are reversed.
+struct Orientation {
+    bool Transpose = false;
+    bool FlipX = false;
+    bool FlipY = false;
+
+    // 0 - horizontal, 1 - vertical
+    static Orientation mirror(int direction);
+
+    // 0 - clockwise, 1 - counterclockwise
+    static Orientation rotate(int direction);
+
+    // this orientation followed by next
+    [[nodiscard]] Orientation then(const Orientation& next) const;
+
+    [[nodiscard]] bool isIdentity() const;
+
+    bool operator==(const Orientation& other) const;
+
+    bool operator!=(const Orientation& other) const;
+};
+
+// maxval - value for every sample, with alpha the last of channels samples is kept
+void invertSamples(byte* data, uint64_t length, uint64_t bytesPerSample, uint64_t maxval,
+                   uint64_t channels = 1, bool alpha = false);
+
+// reverses the pixel order of count rows
+void mirrorRows(byte* rows, uint64_t count, uint64_t width, uint64_t pixelSize);
+
+// swaps the rows top to bottom
+void mirrorColumns(byte* data, uint64_t width, uint64_t height, uint64_t pixelSize);
+
+// an orientation that keeps the size (no transpose) done in place on the rows firstPair to firstPair + count
+// and on the rows they trade places with, the middle row of an odd height pairs with itself.
+// Bands of pairs touch different rows and can run in parallel, (height + 1) / 2 pairs cover the image
+void orientRowPairs(byte* data, uint64_t width, uint64_t height, uint64_t pixelSize, const Orientation& orientation,
+                    uint64_t firstPair, uint64_t count);
+
+// writes src (width x height) turned by 90 degrees into dst (height x width)
+// direction 0 - clockwise, 1 - counterclockwise
+void rotatePixels(const byte* src, byte* dst, uint64_t width, uint64_t height, uint64_t pixelSize, int direction);
+
+// writes src (width x height) laid out by orientation into dst in one pass,
+// dst is height x width when orientation transposes
+void orientPixels(const byte* src, byte* dst, uint64_t width, uint64_t height, uint64_t pixelSize,
+                  const Orientation& orientation);
+
+// orientPixels for count source rows from firstRow on, bands of rows write apart and can run in parallel
+void orientPixelRows(const byte* src, byte* dst, uint64_t width, uint64_t height, uint64_t pixelSize,
+                     const Orientation& orientation, uint64_t firstRow, uint64_t count);
+
+// orientPixels without a second image, data is height x width afterwards when orientation transposes.
+// The orientations that keep the size are mirrors in place. A transposed square swaps every pixel
+// with the up to three others it trades places with, any other rectangle follows the cycles
+// of the permutation with one bit per pixel to mark the visited ones. Slower than orientPixels.
+void orientInPlace(byte* data, uint64_t width, uint64_t height, uint64_t pixelSize, const Orientation& orientation);
+
+
+#endif
@@ -1,11 +1,15 @@
 #include <iostream>
 #include <string>
+#include <cstring>
 #include "PNMImage.h"
 
 using byte = unsigned char;
 
 int main(int argc, char* argv[]) {
-    if (argc != 7) {
+    if (argc >= 3 && strcmp(argv[1], "-p") == 0) { // -p <files>: report the headers, the pixels are never read
+        return probeFiles(argc - 2, argv + 2);
+    }
+    if (argc < 7 || argc % 2 == 0) {
         std::cerr << "Incorrect number of arguments" << std::endl;
         return 1;
     }
@@ -15,6 +19,8 @@ int main(int argc, char* argv[]) {
     int ditheringType;
     bool gradient;
     double gamma;
+    uint64_t bandRows = 0; // -s <rows>: stream the image this many rows at a time
+    Region region;         // -c <x,y,width,height>: dither this rectangle only
 
     auto cleanUp = [](char* in, char* out, PNMImage* im) -> void {
         delete in;
@@ -29,6 +35,20 @@ int main(int argc, char* argv[]) {
         ditheringType = std::stoi(argv[4]);
         bit = std::stoi(argv[5]);
         gamma = std::stof(argv[6]);
+        for (int i = 7; i < argc; i += 2) {
+            if (strcmp(argv[i], "-s") == 0 && std::stoll(argv[i + 1]) > 0) {
+                bandRows = std::stoull(argv[i + 1]);
+            } else if (strcmp(argv[i], "-c") == 0 && Region::parse(argv[i + 1], region) && !region.isWhole()) {
+                // a rectangle inside the image
+            } else {
+                std::cerr << "Incorrect arguments" << std::endl;
+                return 1;
+            }
+        }
+        if (bandRows > 0 && !region.isWhole()) {
+            std::cerr << "Error: a region can not be streamed!" << std::endl;
+            return 1;
+        }
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return 1;
@@ -36,65 +56,78 @@ int main(int argc, char* argv[]) {
 
     PNMImage *picture = nullptr;
 
-    try {
-        picture = new PNMImage(inputFileName);
-    } catch (const std::exception& e) {
-        std::cerr << e.what() << std::endl;
+    if (bandRows > 0) {
+        try {
+            PNMImage::streamDither(inputFileName, outputFileName, bandRows, gradient, ditheringType, bit, gamma);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            cleanUp(inputFileName, outputFileName, picture);
+            return 1;
+        }
         cleanUp(inputFileName, outputFileName, picture);
-        return 1;
+        return 0;
     }
+
+    // every image of a multi-image file is dithered in turn
     try {
-        if (gradient) picture->fillGradient(gamma);
-        switch (ditheringType) {
-            case 0: {
-                picture->ditherNone(bit, gamma);
-                break;
-            }
-            case 1: {
-                picture->ditherOrdered(bit, gamma);
-                break;
-            }
-            case 2: {
-                picture->ditherRandom(bit, gamma);
-                break;
+        PNMFrameReader frames(inputFileName);
+        PNMFrameWriter writer(outputFileName, frames.isSource(outputFileName));
+        PNMFrame frame;
+        while (frames.next(frame)) {
+            picture = new PNMImage(std::move(frame));
+            // the dithers work on the grey sample of a pixel and keep its alpha
+            if (!picture->isGrey()) {
+                throw std::runtime_error("Error: unable to read this file format!");
             }
-            case 3: {
-                picture->ditherFloydSteinberg(bit, gamma);
-                break;
-            }
-            case 4: {
-                picture->ditherJJN(bit, gamma);
-                break;
-            }
-            case 5: {
-                picture->ditherSierra(bit, gamma);
-                break;
-            }
-            case 6: {
-                picture->ditherAtkinson(bit, gamma);
-                break;
-            }
-            case 7: {
-                picture->ditherHalftone(bit, gamma);
-                break;
-            }
-            default: {
+            if (gradient) picture->fillGradient(gamma);
+            switch (ditheringType) {
+                case 0: {
+                    picture->ditherNone(bit, gamma, region);
+                    break;
+                }
+                case 1: {
+                    picture->ditherOrdered(bit, gamma, region);
+                    break;
+                }
+                case 2: {
+                    picture->ditherRandom(bit, gamma, region);
+                    break;
+                }
+                case 3: {
+                    picture->ditherFloydSteinberg(bit, gamma, region);
+                    break;
+                }
+                case 4: {
+                    picture->ditherJJN(bit, gamma, region);
+                    break;
+                }
+                case 5: {
+                    picture->ditherSierra(bit, gamma, region);
+                    break;
+                }
+                case 6: {
+                    picture->ditherAtkinson(bit, gamma, region);
+                    break;
+                }
+                case 7: {
+                    picture->ditherHalftone(bit, gamma, region);
+                    break;
+                }
+                default: {
 
+                }
             }
+            picture->Export(writer);
+            delete picture;
+            picture = nullptr;
         }
+        writer.finish();
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         cleanUp(inputFileName, outputFileName, picture);
         return 1;
     }
 
-    try {
-        picture->Export(outputFileName);
-    } catch (const std::exception& e) {
-        std::cerr << e.what() << std::endl;
-        cleanUp(inputFileName, outputFileName, picture);
-        return 1;
-    }
-
+    cleanUp(inputFileName, outputFileName, picture);
     return 0;
-}
\ No newline at end of file
+}
@@ -1,4 +1,7 @@
 #include "PNMImage.h"
+#include "PNMHeader.h"
+#include "PNMStream.h"
+#include "PixelKernels.h"
 #include <iostream>
 #include <fstream>
 #include <algorithm>
@@ -7,91 +10,20 @@
 #include <vector>
 #include <cmath>
 #include <exception>
+#include <cstring>
+#include <memory>
 #include <random>
 
 const double EPS = 1e-5;
 using byte = unsigned char;
 
-PNMImage::PNMImage(const char* path) {
-    //GET FILE SIZE
-    std::error_code ec{};
-    Size = std::filesystem::file_size(path, ec);
-    if (ec != std::error_code{}) {
-        throw std::runtime_error("Error when accessing file.");
-    }
-    //READ BUFFER
-    Buffer = ReadBinary(path, Size);
-
-    //PARSE BUFFER
-    int flag = 0; // comment flag 0 - not in comment
-    // 1 - in comment
-    // 2 - in data
-    std::vector<byte> Header;
-    std::vector<int> numbers;
-    for (int i = 0; i < Buffer.size(); i++) {
-        char c = Buffer[i];
-        if (flag == 2) {
-            ImageData.push_back(c);
-        }
-        if (flag == 0) {
-            if (c == '#' && numbers.size() < 4) {
-                flag = 1; // in comment
-                continue;
-            }
-            if (c == '\r' || c == '\n' || c == ' ' || c == '\0') {
-                int32_t number = -1;
-                int it = i - 1;
-                while (it > 0) {
-                    if ('0' <= Buffer[it] && Buffer[it] <= '9') {
-                        if (number == -1) number++;
-                        number += (Buffer[it] - '0') * (int)pow(10, i - it - 1);
-                    }
-                    else if (Buffer[it] == '-') {
-                        throw std::runtime_error("Error: negative numbers in header!");
-                    }
-                    else {
-                        break;
-                    }
-                    it--;
-                }
-                if (number != -1)
-                    numbers.push_back(number);
-                if (numbers.size() == 4) {
-                    flag = 2;
-                }
-                Header.push_back('-');
-                continue;
-            }
-            Header.push_back(c);
-        }
-        if (flag == 1 && numbers.size() < 4) {
-            if (c == '\r' || c == '\n') {
-                flag = 0;
-            }
-        }
-    }
-
-    //PARSE HEADER
-    Type = numbers[0];
-    if ((Type != 5 && Type != 6) || Buffer[0] != 'P') {
-        throw std::runtime_error("Error: unable to read this file format!");
-    }
-    Width = numbers[1];
-    Height = numbers[2];
-    if (Width*Height*(Type - 4 + ((Type + 1) % 2)) != ImageData.size()) {
-        throw std::runtime_error("Error: Unexpected EOF!");
-    }
-    ColourDepth = numbers[3];
-    if (ColourDepth != 255) {
-        throw std::runtime_error("Error: unable to read this file format!");
-    }
-}
-
 PNMImage::PNMImage(uint64_t Width_, uint64_t Height_, uint64_t ColourDepth_, uint8_t Type_) {
     Width = Width_;
     Height = Height_;
     ColourDepth = ColourDepth_;
     Type = Type_;
+    Channels = Type == 6 ? 3 : 1;
+    Alpha = false;
 }
 
 PNMImage &PNMImage::operator=(const PNMImage &other) {
@@ -103,6 +35,10 @@ PNMImage &PNMImage::operator=(const PNMImage &other) {
     this->Width = other.Width;
     this->ColourDepth = other.ColourDepth;
     this->Type = other.Type;
+    this->Channels = other.Channels;
+    this->TupleType = other.TupleType;
+    this->Alpha = other.Alpha;
+    this->Pending = other.Pending;
     for (auto c : other.ImageData) {
         this->ImageData.push_back(c);
     }
@@ -115,256 +51,141 @@ PNMImage::PNMImage(const PNMImage& other) {
     this->Width = other.Width;
     this->ColourDepth = other.ColourDepth;
     this->Type = other.Type;
+    this->Channels = other.Channels;
+    this->TupleType = other.TupleType;
+    this->Alpha = other.Alpha;
+    this->Pending = other.Pending;
     for (auto c : other.ImageData) {
         this->ImageData.push_back(c);
     }
 }
 
 bool PNMImage::operator==(const PNMImage &other) const {
-    return (this->Size == other.Size && this->Type == other.Type &&
+    return (this->Size == other.Size && this->Type == other.Type && this->Channels == other.Channels &&
             this->Width == other.Width && this->Height == other.Height &&
             this->ColourDepth == other.ColourDepth);
 }
 
 bool PNMImage::operator!=(const PNMImage &other) const {
-    return !(this->Size == other.Size && this->Type == other.Type &&
+    return !(this->Size == other.Size && this->Type == other.Type && this->Channels == other.Channels &&
              this->Width == other.Width && this->Height == other.Height &&
              this->ColourDepth == other.ColourDepth);
 }
 
-std::vector<byte> PNMImage::ReadBinary(const char* path, uint64_t length) {
-    std::ifstream is(path, std::ios::binary);
-    if (!is) {
-        throw std::runtime_error("Error when opening file.");
-    }
-    std::vector<byte> data;
-    try {
-        data.resize(length);
-    } catch (std::exception& e) {
-        char* error = nullptr;
-        strcat(error, "Buffer error, file too large!\n");
-        strcat(error, e.what());
-        throw std::runtime_error(error);
-    }
-
-    try {
-        is.read(reinterpret_cast<char*>(data.data()), length);
-    } catch (std::exception& e) {
-        char* error = nullptr;
-        strcat(error, "Reading error, file could not be read properly!\n");
-        strcat(error, e.what());
-        throw std::runtime_error(error);
-    }
-    is.close();
-    return data;
+PNMImage::PNMImage(PNMFrame&& frame) {
+    Type = frame.Header.Type;
+    Width = frame.Header.Width;
+    Height = frame.Header.Height;
+    ColourDepth = frame.Header.ColourDepth;
+    Channels = frame.Header.channels();
+    TupleType = frame.Header.TupleType;
+    Alpha = frame.Header.hasAlpha();
+    Size = frame.Header.DataOffset + frame.Header.DataSize;
+    ImageData = std::move(frame.Data);
 }
 
-void PNMImage::WriteBinary(const char* path, const std::vector<byte>& vector) {
-    std::ofstream os(path, std::ios::binary);
-    if (!os) {
-        throw std::runtime_error("Error creating output file!");
-    }
-    try {
-        os.write(reinterpret_cast<const char*>(&vector[0]), vector.size());
-    } catch (std::exception& e) {
-        char* error = nullptr;
-        strcat(error, "Writing error, file could not be written properly!\n");
-        strcat(error, e.what());
-        throw std::runtime_error(error);
-    }
-    os.flush();
-    os.close();
+PNMHeader PNMImage::header() const {
+    PNMHeader header;
+    header.Type = Type;
+    header.Width = Width;
+    header.Height = Height;
+    header.ColourDepth = ColourDepth;
+    header.Depth = Channels;
+    header.TupleType = TupleType;
+    return header;
 }
 
-void PNMImage::Export(const char* path) {
-    Buffer.clear();
-
-    Buffer.push_back('P');
-    Buffer.push_back(char(Type + '0'));
-    Buffer.push_back('\n');
-
-
-    std::string Width__ = std::to_string(Width);
-    std::string Height__ = std::to_string(Height);
-    std::string ColourDepth__ = std::to_string(ColourDepth);
-
-    for (auto c : Width__) {
-        Buffer.push_back(c);
-    }
-
-    Buffer.push_back(' ');
-
-    for (auto c : Height__) {
-        Buffer.push_back(c);
-    }
-
-    Buffer.push_back('\n');
-
-    for (auto c : ColourDepth__) {
-        Buffer.push_back(c);
-    }
-
-    Buffer.push_back('\n'); // fix 5 for mac ' '
-
-    for (auto c : ImageData) {
-        Buffer.push_back(c);
-    }
-
-    WriteBinary(path, Buffer);
+void PNMImage::Export(PNMFrameWriter& writer) {
+    settle();
+    writer.write(header(), ImageData.data(), ImageData.size());
 }
 
 void PNMImage::Invert() {
-    for (auto & i : ImageData) {
-        i = ~i;
-    }
+    invertSamples(ImageData.data(), ImageData.size(), bytesPerSample(), ColourDepth, Channels, Alpha);
 }
 
 void PNMImage::Mirror(int direction) {
     // 0 - horizontal
     // 1 - vertical
-    if (direction == 0) {
-        if (Type == 5) {
-            uint64_t i,j;
-            for (i = 0; i < Height; i++) {
-                for (j = 0; j < Width/2; j++) {
-                    std::swap(ImageData[i*Width + j], ImageData[i*Width + Width - 1 - j]);
-                }
-            }
-        } else {
-            uint64_t i,j;
-            for (i = 0; i < Height; i++) {
-                for (j = 0; j < Width*3/2; j+=3) {
-                    std::swap(ImageData[i*Width*3 + j], ImageData[i*Width*3 + Width*3 - j - 3]);
-                    std::swap(ImageData[i*Width*3 + j + 1], ImageData[i*Width*3 + Width*3 - j - 2]);
-                    std::swap(ImageData[i*Width*3 + j + 2], ImageData[i*Width*3 + Width*3 - j - 1]);
-                }
-            }
-        }
-    }
-    if (direction == 1) {
-        if (Type == 5) {
-            uint64_t i,j;
-            for (i = 0; i < Width; i++) {
-                for (j = 0; j < Height/2; j++) {
-                    std::swap(ImageData[j * Width + i], ImageData[(Height - 1 - j) * Width + i]);
-                }
-            }
-        } else {
-            uint64_t i,j;
-            for (i = 0; i < Width*3; i++) {
-                for (j = 0; j < Height/2; j++) {
-                    std::swap(ImageData[j * Width*3 + i], ImageData[(Height - 1 - j) * Width*3 + i]);
-                }
-            }
-        }
-    }
+    Pending = Pending.then(Orientation::mirror(direction));
 }
 
 void PNMImage::Rotate(int direction) {
     // 0 - clockwise
     // 1 - counterclockwise
-    if (direction == 0) {
-        if (Type == 5) {
-            std::vector<byte> NewImageData;
-            uint64_t NewWidth, NewHeight;
-            NewHeight = Width;
-            NewWidth = Height;
-            try {
-                NewImageData.resize(Width * Height);
-            } catch (std::exception& e) {
-                char* error = nullptr;
-                strcat(error, "Memory error during rotation!\n");
-                strcat(error, e.what());
-                throw std::runtime_error(error);
-            }
-            for (uint64_t i = 0; i < Height; i++) {
-                for (uint64_t j = 0; j < Width; j++) {
-                    NewImageData[(NewWidth - i - 1) + j*NewWidth] = ImageData[i*Width + j];
-                }
-            }
-            Width = NewWidth;
-            Height = NewHeight;
-            ImageData = NewImageData;
-        } else {
-            std::vector<byte> NewImageData;
-            uint64_t NewWidth, NewHeight;
-            NewHeight = Width;
-            NewWidth = Height;
-            try {
-                NewImageData.resize(Width * Height * 3);
-            } catch (std::exception& e) {
-                char* error = nullptr;
-                strcat(error, "Memory error during rotation!\n");
-                strcat(error, e.what());
-                throw std::runtime_error(error);
-            }
-            for (uint64_t i = 0; i < Height; i++) {
-                for (uint64_t j = 0; j < Width; j++) {
-                    NewImageData[(NewWidth - i - 1)*3 + j*NewWidth*3] = ImageData[j*3 + Width*3*i];
-                    NewImageData[(NewWidth - i - 1)*3 + j*NewWidth*3 + 1] = ImageData[j*3 + Width*3*i + 1];
-                    NewImageData[(NewWidth - i - 1)*3 + j*NewWidth*3 + 2] = ImageData[j*3 + Width*3*i + 2];
-                }
-            }
-            Width = NewWidth;
-            Height = NewHeight;
-            ImageData = NewImageData;
-        }
+    Pending = Pending.then(Orientation::rotate(direction));
+    std::swap(Width, Height);
+}
+
+ImageView PNMImage::storedView(const Region& region) {
+    uint64_t width = Pending.Transpose ? Height : Width; // as the pixels are stored
+    uint64_t height = Pending.Transpose ? Width : Height;
+    ImageView whole(ImageData.data(), width, height, Channels, bytesPerSample());
+    return whole.sub(region.stored(Pending, Width, Height));
+}
+
+void PNMImage::Invert(const Region& region) {
+    invertView(storedView(region), ColourDepth, Alpha);
+}
+
+void PNMImage::Mirror(int direction, const Region& region) {
+    if (region.isWhole()) {
+        Mirror(direction);
+        return;
     }
-    if (direction == 1) {
-        if (Type == 5) {
-            std::vector<byte> NewImageData;
-            uint64_t NewWidth, NewHeight;
-            NewHeight = Width;
-            NewWidth = Height;
-            try {
-                NewImageData.resize(Width * Height);
-            } catch (std::exception& e) {
-                char* error = nullptr;
-                strcat(error, "Memory error during rotation!\n");
-                strcat(error, e.what());
-                throw std::runtime_error(error);
-            }
-            for (uint64_t i = 0; i < Height; i++) {
-                for (uint64_t j = 0; j < Width; j++) {
-                    NewImageData[j*NewWidth + i] = ImageData[(i + 1)*Width - 1 - j];
-                }
-            }
-            Width = NewWidth;
-            Height = NewHeight;
-            ImageData = NewImageData;
-        } else {
-            std::vector<byte> NewImageData;
-            uint64_t NewWidth, NewHeight;
-            NewHeight = Width;
-            NewWidth = Height;
-            try {
-                NewImageData.resize(Width * Height * 3);
-            } catch (std::exception& e) {
-                char* error = nullptr;
-                strcat(error, "Memory error during rotation!\n");
-                strcat(error, e.what());
-                throw std::runtime_error(error);
-            }
-            for (uint64_t i = 0; i < Height; i++) {
-                for (uint64_t j = 0; j < Width; j++) {
-                    NewImageData[(NewHeight - 1 - j)*NewWidth*3 + i*3] = ImageData[i*Width*3 + j*3];
-                    NewImageData[(NewHeight - 1 - j)*NewWidth*3 + i*3 + 1] = ImageData[i*Width*3 + j*3 + 1];
-                    NewImageData[(NewHeight - 1 - j)*NewWidth*3 + i*3 + 2] = ImageData[i*Width*3 + j*3 + 2];
-                }
-            }
-            Width = NewWidth;
-            Height = NewHeight;
-            ImageData = NewImageData;
+    // a flip of the rows of the image is a flip of the columns where it is stored transposed
+    mirrorView(storedView(region), Pending.Transpose ? 1 - direction : direction);
+}
+
+void PNMImage::crop(const Region& region) {
+    // the pending orientation is kept and later moves the smaller image only
+    Region area = region.within(Width, Height);
+    ImageView view = storedView(area);
+    std::vector<byte> cropped(view.rowSize() * view.Height);
+    copyView(view, cropped.data());
+    ImageData = std::move(cropped);
+    Width = area.Width;
+    Height = area.Height;
+}
+
+void PNMImage::settle() {
+    if (Pending.isIdentity()) {
+        return;
+    }
+    Orientation orientation = Pending;
+    Pending = Orientation();
+    uint64_t width = orientation.Transpose ? Height : Width; // as the pixels are stored
+    uint64_t height = orientation.Transpose ? Width : Height;
+    std::vector<byte> NewImageData;
+    if (orientation.Transpose) {
+        try {
+            NewImageData.resize(ImageData.size());
+        } catch (std::exception&) {
+            // not enough memory for a second image, the slower way needs none
         }
     }
+    if (NewImageData.empty()) {
+        orientInPlace(ImageData.data(), width, height, pixelSize(), orientation);
+        return;
+    }
+    orientPixels(ImageData.data(), NewImageData.data(), width, height, pixelSize(), orientation);
+    ImageData = std::move(NewImageData);
+}
+
+uint64_t PNMImage::bytesPerSample() const {
+    return ColourDepth > 255 ? 2 : 1;
+}
+
+uint64_t PNMImage::pixelSize() const {
+    return Channels * bytesPerSample();
 }
 
 bool PNMImage::isGrey() const {
-    return Type == 5;
+    return Channels == 1 || (Channels == 2 && Alpha);
 }
 
 bool PNMImage::isColor() const {
-    return Type == 6;
+    return Channels == 3 || (Channels == 4 && Alpha);
 }
 
 void PNMImage::drawPoint(int x, int y, double opacity, byte color, double gamma) { // видимо не умею считать вернул в развернутый вариант
@@ -394,6 +215,7 @@ void PNMImage::drawPoint(int x, int y, double opacity, byte color, double gamma)
 }
 
 void PNMImage::drawThickLine(double x0, double y0, double x1, double y1, byte color, double thiccness, double gamma) {
+    settle();
     if (!isGrey()) {
         throw std::runtime_error("Error: Incorrect color!");
     }
@@ -507,6 +329,7 @@ double PNMImage::closestPaletteColor(byte px, byte bitRate) {
 }
 
 void PNMImage::fillGradient(double gamma) {
+    settle();
     for (int i = 0; i < Height; ++i) {
         for (int j = 0; j < Width; ++j) {
             pixel(i, j) = encodeGamma((double)j/(Width - 1.0), gamma)*255; // fix gradient 0-255 not 254
@@ -526,6 +349,7 @@ void PNMImage::ditherNone(byte bitRate, double gamma) {
 }
 
 void PNMImage::ditherOrdered(byte bitRate, double gamma) {
+    settle();
     const double orderedMatrix[8][8] = {
             {1.0 / 64.0, 49.0 / 64.0, 13.0 / 64.0, 61.0 / 64.0, 4.0 / 64.0, 52.0 / 64.0, 16.0 / 64.0, 64.0 / 64.0},
             {33.0 / 64.0, 17.0 / 64.0, 45.0 / 64.0, 29.0 / 64.0, 36.0 / 64.0, 20.0 / 64.0, 48.0 / 64.0, 32.0 / 64.0},
@@ -563,6 +387,7 @@ void PNMImage::ditherRandom(byte bitRate, double gamma) {
 }
 
 void PNMImage::ditherFloydSteinberg(byte bitRate, double gamma) {
+    settle();
     std::vector<double> errors(Height * Width, 0);
     auto getError = [&](int h, int w) -> double& {
         return errors[h * Width + w];
@@ -593,6 +418,7 @@ void PNMImage::ditherFloydSteinberg(byte bitRate, double gamma) {
 }
 
 void PNMImage::ditherJJN(byte bitRate, double gamma) {
+    settle();
     const double matrixJJN[3][5] = {
             {0, 0, 0, 7.0 / 48.0, 5.0 / 48.0},
             {3.0 / 48.0, 5.0 / 48.0, 7.0 / 48.0, 5.0 / 48.0, 3.0 / 48.0},
@@ -631,6 +457,7 @@ void PNMImage::ditherJJN(byte bitRate, double gamma) {
 }
 
 void PNMImage::ditherSierra(byte bitRate, double gamma) {
+    settle();
     const double matrixSierra3[3][5] = {
             {0, 0, 0, 5.0 / 32.0, 3.0 / 32.0},
             {2.0 / 32.0, 4.0/ 32.0, 5.0 / 32.0, 4.0 / 32.0, 2.0 / 32.0},
@@ -669,6 +496,7 @@ void PNMImage::ditherSierra(byte bitRate, double gamma) {
 }
 
 void PNMImage::ditherAtkinson(byte bitRate, double gamma) {
+    settle();
     const int matrixAtkinson[3][5] = {
             {0, 0, 0, 1, 1},
             {0, 1, 1, 1, 0},
@@ -707,6 +535,7 @@ void PNMImage::ditherAtkinson(byte bitRate, double gamma) {
 }
 
 void PNMImage::ditherHalftone(byte bitRate, double gamma) {
+    settle();
 //    const double halftoneMatrix[4][4] = {7 / 16.0, 13 / 16.0, 11 / 16.0, 4 / 16.0,
 //                                          12 / 16.0, 16 / 16.0, 14 / 16.0, 8 / 16.0,
 //                                          10 / 16.0, 15 / 16.0, 6 / 16.0, 2 / 16.0,
@@ -734,12 +563,25 @@ PNMImage PNMImage::mergeBytes(const PNMImage &source1, const PNMImage &source2,
         throw std::runtime_error("Error, merging images are not grey!");
     }
 
+    if (source1.Pending != source2.Pending || source2.Pending != source3.Pending) {
+        // the channels must be laid out alike before they are interleaved
+        PNMImage settled1(source1), settled2(source2), settled3(source3);
+        settled1.settle();
+        settled2.settle();
+        settled3.settle();
+        return mergeBytes(settled1, settled2, settled3);
+    }
     PNMImage result(source1.Width, source1.Height, source1.ColourDepth, 6);
+    result.Pending = source1.Pending;
 
-    for(int i = 0; i < result.Height*result.Width; i++) {
-        result.ImageData.push_back(source1.ImageData[i]);
-        result.ImageData.push_back(source2.ImageData[i]);
-        result.ImageData.push_back(source3.ImageData[i]);
+    // whole samples, 16-bit ones are two bytes. The grey sample of each pixel is taken and an alpha one
+    // is dropped, as splitting drops it
+    uint64_t bytes = source1.bytesPerSample();
+    uint64_t step = source1.Channels * bytes;
+    for(uint64_t i = 0; i < result.Height*result.Width*step; i += step) {
+        for (uint64_t k = 0; k < bytes; k++) result.ImageData.push_back(source1.ImageData[i + k]);
+        for (uint64_t k = 0; k < bytes; k++) result.ImageData.push_back(source2.ImageData[i + k]);
+        for (uint64_t k = 0; k < bytes; k++) result.ImageData.push_back(source3.ImageData[i + k]);
     }
 
     return result;
@@ -751,9 +593,11 @@ PNMImage PNMImage::pull1stByte(const PNMImage &source) {
     }
 
     PNMImage result(source.Width, source.Height, source.ColourDepth, 5);
+    result.Pending = source.Pending; // one channel keeps the layout of the pixels
 
-    for(int i = 0; i < source.ImageData.size(); i+=3) {
-        result.ImageData.push_back(source.ImageData[i]);
+    uint64_t bytes = source.bytesPerSample();
+    for(uint64_t i = 0*bytes; i < source.ImageData.size(); i+=source.Channels*bytes) {
+        for (uint64_t k = 0; k < bytes; k++) result.ImageData.push_back(source.ImageData[i + k]);
     }
 
     return result;
@@ -765,9 +609,11 @@ PNMImage PNMImage::pull2ndByte(const PNMImage &source) {
     }
 
     PNMImage result(source.Width, source.Height, source.ColourDepth, 5);
+    result.Pending = source.Pending; // one channel keeps the layout of the pixels
 
-    for(int i = 1; i < source.ImageData.size(); i+=3) {
-        result.ImageData.push_back(source.ImageData[i]);
+    uint64_t bytes = source.bytesPerSample();
+    for(uint64_t i = 1*bytes; i < source.ImageData.size(); i+=source.Channels*bytes) {
+        for (uint64_t k = 0; k < bytes; k++) result.ImageData.push_back(source.ImageData[i + k]);
     }
 
     return result;
@@ -779,262 +625,296 @@ PNMImage PNMImage::pull3rdByte(const PNMImage &source) {
     }
 
     PNMImage result(source.Width, source.Height, source.ColourDepth, 5);
+    result.Pending = source.Pending; // one channel keeps the layout of the pixels
 
-    for(int i = 2; i < source.ImageData.size(); i+=3) {
-        result.ImageData.push_back(source.ImageData[i]);
+    uint64_t bytes = source.bytesPerSample();
+    for(uint64_t i = 2*bytes; i < source.ImageData.size(); i+=source.Channels*bytes) {
+        for (uint64_t k = 0; k < bytes; k++) result.ImageData.push_back(source.ImageData[i + k]);
     }
 
     return result;
 }
 
-void PNMImage::convertColorSpace(char *from, char *to) {
-    std::vector<byte> result;
-    std::vector<byte> RGB;
+void PNMImage::convertColorSpace(char *from, char *to, const Region& region) {
+    if (!isColor()) {
+        throw std::runtime_error("Error, converted image is not color!");
+    }
+    // every pixel on its own, so the region is converted where it is stored
+    ImageView view = storedView(region);
+    view.forEachRun([&](byte* rows, uint64_t, uint64_t count) {
+        convertColorSpaceRows(rows, count * view.rowSize(), ColourDepth, Channels, from, to);
+    });
+}
 
-    auto roundToByte = [](int val) -> byte{
-        return (byte)std::min(std::max(val, 0), 255);
-    };
+void PNMImage::convertColorSpaceRows(byte* data, uint64_t length, uint64_t maxval, uint64_t channels,
+                                     const char* from, const char* to) {
+    // one pass per sample size, no conversion of the image to double first
+    withSample(maxval > 255 ? 2 : 1, [&](auto sample) {
+        using Sample = decltype(sample);
+        uint64_t samples = length / Sample::Bytes;
+        double scale = maxval;
+        std::vector<uint32_t> result;
+        std::vector<uint32_t> RGB;
 
-    if (!strcmp(from, "RGB")) {
-         RGB = ImageData;
-    } else if (!strcmp(from, "HSL")) {
-        RGB.resize(ImageData.size());
-        for (int i = 0; i < ImageData.size(); i+=3) {
-            double H = ImageData[i]/255.0 * 6;
-            double S = ImageData[i+1]/255.0;
-            double L = ImageData[i+2]/255.0;
-            double C = (1 - abs(2*L - 1)) * S;
-            double X = C * (1 - abs((int)(H)%2 + (H - (int)H) - 1));
-            double m = L - C / 2.0;
-            double R,G,B;
-            if (std::ceil(H) - 1.0 < 1e-4) {
-                R = C; G = X; B = 0;
-            } else if (std::ceil(H) - 2.0 < 1e-4) {
-                R = X; G = C; B = 0;
-            } else if (std::ceil(H) - 3.0 < 1e-4) {
-                R = 0; G = C; B = X;
-            } else if (std::ceil(H) - 4.0 < 1e-4) {
-                R = 0; G = X; B = C;
-            } else if (std::ceil(H) - 5.0 < 1e-4) {
-                R = X; G = 0; B = C;
-            } else if (std::ceil(H) - 6.0 < 1e-4) {
-                R = C; G = 0; B = X;
-            } else {
-                throw std::runtime_error("Error H value out of range!");
-            }
-            RGB[i]   = roundToByte((int)((R+m)*255));
-            RGB[i+1] = roundToByte((int)((G+m)*255));
-            RGB[i+2] = roundToByte((int)((B+m)*255));
+        auto roundToSample = [&](int val) -> uint32_t{
+            return (uint32_t)std::min(std::max(val, 0), (int)maxval);
+        };
+        auto sampleAt = [&](uint64_t i) -> uint32_t {
+            return Sample::load(data + i * Sample::Bytes);
+        };
+
+        // every sample is read first, so an alpha channel goes through as it is
+        RGB.resize(samples);
+        for (uint64_t i = 0; i < samples; i++) {
+            RGB[i] = sampleAt(i);
         }
-    } else if (!strcmp(from, "HSV")) {
-        RGB.resize(ImageData.size());
-        for (int i = 0; i < ImageData.size(); i+=3) {
-            double H = ImageData[i]/255.0*6;
-            double S = ImageData[i+1]/255.0;
-            double V = ImageData[i+2]/255.0;
-            const double PI = 3.1416926;
-            double C = V * S;
-            double X = C * (1 - abs((int)(H) % 2 +(H-(int)H)- 1));
-            double m = V - C;
-            double R,G,B;
-            if (H >= 0.0 && H <= 1.0) {
-                R = C; G = X; B = 0;
-            } else if (H >= 1.0 && H <= 2.0) {
-                R = X; G = C; B = 0;
-            } else if (H >= 2.0 && H <= 3.0) {
-                R = 0; G = C; B = X;
-            } else if (H >= 3.0 && H <= 4.0) {
-                R = 0; G = X; B = C;
-            } else if (H >= 4.0 && H <= 5.0) {
-                R = X; G = 0; B = C;
-            } else if (H >= 5.0 && H <= 6.0) {
-                R = C; G = 0; B = X;
-            } else {
-                throw std::runtime_error("Error H value out of range!");
+
+        if (!strcmp(from, "RGB")) {
+            // nothing to convert
+        } else if (!strcmp(from, "HSL")) {
+            for (int i = 0; i < samples; i+=channels) {
+                double H = sampleAt(i)/scale * 6;
+                double S = sampleAt(i+1)/scale;
+                double L = sampleAt(i+2)/scale;
+                double C = (1 - abs(2*L - 1)) * S;
+                double X = C * (1 - abs((int)(H)%2 + (H - (int)H) - 1));
+                double m = L - C / 2.0;
+                double R,G,B;
+                if (std::ceil(H) - 1.0 < 1e-4) {
+                    R = C; G = X; B = 0;
+                } else if (std::ceil(H) - 2.0 < 1e-4) {
+                    R = X; G = C; B = 0;
+                } else if (std::ceil(H) - 3.0 < 1e-4) {
+                    R = 0; G = C; B = X;
+                } else if (std::ceil(H) - 4.0 < 1e-4) {
+                    R = 0; G = X; B = C;
+                } else if (std::ceil(H) - 5.0 < 1e-4) {
+                    R = X; G = 0; B = C;
+                } else if (std::ceil(H) - 6.0 < 1e-4) {
+                    R = C; G = 0; B = X;
+                } else {
+                    throw std::runtime_error("Error H value out of range!");
+                }
+                RGB[i]   = roundToSample((int)((R+m)*scale));
+                RGB[i+1] = roundToSample((int)((G+m)*scale));
+                RGB[i+2] = roundToSample((int)((B+m)*scale));
             }
-            RGB[i]   = roundToByte((int)((R+m)*255));
-            RGB[i+1] = roundToByte((int)((G+m)*255));
-            RGB[i+2] = roundToByte((int)((B+m)*255));
-        }
-    } else if (!strcmp(from, "YCbCr.601")) {
-        double Kb = 0.299;
-        double Kr = 0.587;
-        double Kg = 0.114;
-        RGB.resize(ImageData.size());
-        for (int i = 0; i < ImageData.size(); i+=3) {
-            double Y =  ImageData[i]     / 255.0;
-            double Cb = ImageData[i + 1] / 255.0 - 0.5;
-            double Cr = ImageData[i + 2] / 255.0 - 0.5;
-            double R = Y + (2 - 2 * Kr) * Cr;
-            double G = Y - Kb * (2 - 2 * Kb) * Cb / Kg - Kr * (2 - 2 * Kr) * Cr / Kg;
-            double B = Y + (2 - 2 * Kb) * Cb;
-            RGB[i]   = roundToByte((int)(R*255));
-            RGB[i+1] = roundToByte((int)(G*255));
-            RGB[i+2] = roundToByte((int)(B*255));
-        }
-    } else if (!strcmp(from, "YCbCr.709")) {
-        double Kb = 0.0722;
-        double Kr = 0.2126;
-        double Kg = 0.7152;
-        RGB.resize(ImageData.size());
-        for (int i = 0; i < ImageData.size(); i+=3) {
-            double Y =   ImageData[i]     / 255.0;
-            double Cb = ImageData[i + 1] / 255.0 - 0.5;
-            double Cr = ImageData[i + 2] / 255.0 - 0.5;
-            double R = Y + (2 - 2 * Kr) * Cr;
-            double G = Y - Kb * (2 - 2 * Kb) * Cb / Kg - Kr * (2 - 2 * Kr) * Cr / Kg;
-            double B = Y + (2 - 2 * Kb) * Cb;
-            RGB[i]   = roundToByte((int)(R*255));
-            RGB[i+1] = roundToByte((int)(G*255));
-            RGB[i+2] = roundToByte((int)(B*255));
-        }
-    } else if (!strcmp(from, "YCoCg")) {
-        RGB.resize(ImageData.size());
-        for (int i = 0; i < ImageData.size(); i+=3) {
-            double Y = ImageData[i]/255.0;
-            double Co = ImageData[i+1]/255.0 - 0.5;
-            double Cg = ImageData[i+2]/255.0 - 0.5;
-            RGB[i]   = roundToByte((int)((Y+Co-Cg)*255));
-            RGB[i+1] = roundToByte((int)((Y+Cg)*255));
-            RGB[i+2] = roundToByte((int)((Y-Co-Cg)*255));
-        }
-    } else if (!strcmp(from, "CMY")) {
-        RGB.resize(ImageData.size());
-        for (int i = 0; i < ImageData.size(); i+=3) {
-            double C = ImageData[i]/255.0;
-            double M = ImageData[i+1]/255.0;
-            double Y = ImageData[i+2]/255.0;
-            RGB[i]   = roundToByte((int)((1-C)*255));
-            RGB[i+1] = roundToByte((int)((1-M)*255));
-            RGB[i+2] = roundToByte((int)((1-Y)*255));
+        } else if (!strcmp(from, "HSV")) {
+            for (int i = 0; i < samples; i+=channels) {
+                double H = sampleAt(i)/scale*6;
+                double S = sampleAt(i+1)/scale;
+                double V = sampleAt(i+2)/scale;
+                const double PI = 3.1416926;
+                double C = V * S;
+                double X = C * (1 - abs((int)(H) % 2 +(H-(int)H)- 1));
+                double m = V - C;
+                double R,G,B;
+                if (H >= 0.0 && H <= 1.0) {
+                    R = C; G = X; B = 0;
+                } else if (H >= 1.0 && H <= 2.0) {
+                    R = X; G = C; B = 0;
+                } else if (H >= 2.0 && H <= 3.0) {
+                    R = 0; G = C; B = X;
+                } else if (H >= 3.0 && H <= 4.0) {
+                    R = 0; G = X; B = C;
+                } else if (H >= 4.0 && H <= 5.0) {
+                    R = X; G = 0; B = C;
+                } else if (H >= 5.0 && H <= 6.0) {
+                    R = C; G = 0; B = X;
+                } else {
+                    throw std::runtime_error("Error H value out of range!");
+                }
+                RGB[i]   = roundToSample((int)((R+m)*scale));
+                RGB[i+1] = roundToSample((int)((G+m)*scale));
+                RGB[i+2] = roundToSample((int)((B+m)*scale));
+            }
+        } else if (!strcmp(from, "YCbCr.601")) {
+            double Kb = 0.299;
+            double Kr = 0.587;
+            double Kg = 0.114;
+            for (int i = 0; i < samples; i+=channels) {
+                double Y =  sampleAt(i)     / scale;
+                double Cb = sampleAt(i + 1) / scale - 0.5;
+                double Cr = sampleAt(i + 2) / scale - 0.5;
+                double R = Y + (2 - 2 * Kr) * Cr;
+                double G = Y - Kb * (2 - 2 * Kb) * Cb / Kg - Kr * (2 - 2 * Kr) * Cr / Kg;
+                double B = Y + (2 - 2 * Kb) * Cb;
+                RGB[i]   = roundToSample((int)(R*scale));
+                RGB[i+1] = roundToSample((int)(G*scale));
+                RGB[i+2] = roundToSample((int)(B*scale));
+            }
+        } else if (!strcmp(from, "YCbCr.709")) {
+            double Kb = 0.0722;
+            double Kr = 0.2126;
+            double Kg = 0.7152;
+            for (int i = 0; i < samples; i+=channels) {
+                double Y =   sampleAt(i)     / scale;
+                double Cb = sampleAt(i + 1) / scale - 0.5;
+                double Cr = sampleAt(i + 2) / scale - 0.5;
+                double R = Y + (2 - 2 * Kr) * Cr;
+                double G = Y - Kb * (2 - 2 * Kb) * Cb / Kg - Kr * (2 - 2 * Kr) * Cr / Kg;
+                double B = Y + (2 - 2 * Kb) * Cb;
+                RGB[i]   = roundToSample((int)(R*scale));
+                RGB[i+1] = roundToSample((int)(G*scale));
+                RGB[i+2] = roundToSample((int)(B*scale));
+            }
+        } else if (!strcmp(from, "YCoCg")) {
+            for (int i = 0; i < samples; i+=channels) {
+                double Y = sampleAt(i)/scale;
+                double Co = sampleAt(i+1)/scale - 0.5;
+                double Cg = sampleAt(i+2)/scale - 0.5;
+                RGB[i]   = roundToSample((int)((Y+Co-Cg)*scale));
+                RGB[i+1] = roundToSample((int)((Y+Cg)*scale));
+                RGB[i+2] = roundToSample((int)((Y-Co-Cg)*scale));
+            }
+        } else if (!strcmp(from, "CMY")) {
+            for (int i = 0; i < samples; i+=channels) {
+                double C = sampleAt(i)/scale;
+                double M = sampleAt(i+1)/scale;
+                double Y = sampleAt(i+2)/scale;
+                RGB[i]   = roundToSample((int)((1-C)*scale));
+                RGB[i+1] = roundToSample((int)((1-M)*scale));
+                RGB[i+2] = roundToSample((int)((1-Y)*scale));
+            }
+        } else {
+            throw std::runtime_error("Error, unsupported input color space!");
         }
-    } else {
-        throw std::runtime_error("Error, unsupported input color space!");
-    }
 
-    if (!strcmp(to, "RGB")) {
-        result = RGB;
-    } else if (!strcmp(to, "HSL")) {
-        result.resize(RGB.size()); // to HSL
-        for (int i = 0; i < RGB.size(); i+=3) {
-            double R = RGB[i]/255.0;
-            double G = RGB[i + 1]/255.0;
-            double B = RGB[i + 2]/255.0;
-            double Cmin = std::min(R, std::min(G, B));
-            double Cmax = std::max(R, std::max(G, B));
-            double delta = Cmax - Cmin;
-            double L = (Cmax + Cmin)/2.0;
-            double S = 0, H = 0;
-            if (L == 0 || L == 1) {
-                S = 0;
-            } else {
-                S = (Cmax - L)/std::min(1.0, 1 - L);
-            }
+        if (!strcmp(to, "RGB")) {
+            result = RGB;
+        } else if (!strcmp(to, "HSL")) {
+            result = RGB; // to HSL
+            for (int i = 0; i < RGB.size(); i+=channels) {
+                double R = RGB[i]/scale;
+                double G = RGB[i + 1]/scale;
+                double B = RGB[i + 2]/scale;
+                double Cmin = std::min(R, std::min(G, B));
+                double Cmax = std::max(R, std::max(G, B));
+                double delta = Cmax - Cmin;
+                double L = (Cmax + Cmin)/2.0;
+                double S = 0, H = 0;
+                if (L == 0 || L == 1) {
+                    S = 0;
+                } else {
+                    S = (Cmax - L)/std::min(1.0, 1 - L);
+                }
 
-            if (delta == 0) {
-                H = 0;
-            } else if (Cmax == R) {
-                H = (G-B)/delta;
-            } else if (Cmax == G) {
-                H = (B-R)/delta + 2;
-            } else if (Cmax == B) {
-                H = (R-G)/delta + 4;
-            } else {
-                throw std::runtime_error("Error unable to convert to HSL");
+                if (delta == 0) {
+                    H = 0;
+                } else if (Cmax == R) {
+                    H = (G-B)/delta;
+                } else if (Cmax == G) {
+                    H = (B-R)/delta + 2;
+                } else if (Cmax == B) {
+                    H = (R-G)/delta + 4;
+                } else {
+                    throw std::runtime_error("Error unable to convert to HSL");
+                }
+                H *= 60;
+                if (H < 0)  H += 360;
+                result[i] = roundToSample((int)(H/360.0*scale));
+                result[i+1] = roundToSample((int)(S*scale));
+                result[i+2] = roundToSample((int)(L*scale));
             }
-            H *= 60;
-            if (H < 0)  H += 360;
-            result[i] = roundToByte((int)(H/360.0*255));
-            result[i+1] = roundToByte((int)(S*255));
-            result[i+2] = roundToByte((int)(L*255));
-        }
-    } else if (!strcmp(to, "HSV")) {
-        result.resize(RGB.size()); // to HSV
-        for (int i = 0; i < RGB.size(); i+=3) {
-            double R = RGB[i]/255.0;
-            double G = RGB[i + 1]/255.0;
-            double B = RGB[i + 2]/255.0;
-            double Cmin = std::min(R, std::min(G, B));
-            double Cmax = std::max(R, std::max(G, B));
-            double delta = Cmax - Cmin;
-            double V = Cmax;
-            double S = 0, H = 0;
-            if (V == 0) {
-                S = 0;
-            } else {
-                S = delta/Cmax;
+        } else if (!strcmp(to, "HSV")) {
+            result = RGB; // to HSV
+            for (int i = 0; i < RGB.size(); i+=channels) {
+                double R = RGB[i]/scale;
+                double G = RGB[i + 1]/scale;
+                double B = RGB[i + 2]/scale;
+                double Cmin = std::min(R, std::min(G, B));
+                double Cmax = std::max(R, std::max(G, B));
+                double delta = Cmax - Cmin;
+                double V = Cmax;
+                double S = 0, H = 0;
+                if (V == 0) {
+                    S = 0;
+                } else {
+                    S = delta/Cmax;
+                }
+                if (delta == 0) {
+                    H = 0;
+                } else if (Cmax == R) {
+                    H = (G-B)/delta;
+                } else if (Cmax == G) {
+                    H = (B-R)/delta + 2;
+                } else if (Cmax == B) {
+                    H = (R-G)/delta + 4;
+                } else {
+                    throw std::runtime_error("Error unable to convert to HSL");
+                }
+                H *= 60;
+                if (H<0) H+=360;
+                result[i] = roundToSample((int)(H/360*scale));
+                result[i+1] = roundToSample((int)(S*scale));
+                result[i+2] = roundToSample((int)(V*scale));
             }
-            if (delta == 0) {
-                H = 0;
-            } else if (Cmax == R) {
-                H = (G-B)/delta;
-            } else if (Cmax == G) {
-                H = (B-R)/delta + 2;
-            } else if (Cmax == B) {
-                H = (R-G)/delta + 4;
-            } else {
-                throw std::runtime_error("Error unable to convert to HSL");
+        } else if (!strcmp(to, "YCbCr.601")) {
+            double Kb = 0.299;
+            double Kr = 0.587;
+            double Kg = 0.114;
+            result = RGB; // to YCbCr.601
+            for (int i = 0; i < RGB.size(); i+=channels) {
+                double R = RGB[i] / scale;
+                double G = RGB[i + 1] / scale;
+                double B = RGB[i + 2] / scale;
+                double Y =   Kr * R + Kg * G + Kb * B;
+                double Cb = (B - Y) / (2 * (1 - Kb));
+                double Cr = (R - Y) / (2 * (1 - Kr));
+                result[i]   = roundToSample((int)(Y*scale)); // Y
+                result[i+1] = roundToSample((int)((Cb+0.5)*scale)); // Cb
+                result[i+2] = roundToSample((int)((Cr+0.5)*scale)); // Cr
             }
-            H *= 60;
-            if (H<0) H+=360;
-            result[i] = roundToByte((int)(H/360*255));
-            result[i+1] = roundToByte((int)(S*255));
-            result[i+2] = roundToByte((int)(V*255));
-        }
-    } else if (!strcmp(to, "YCbCr.601")) {
-        double Kb = 0.299;
-        double Kr = 0.587;
-        double Kg = 0.114;
-        result.resize(RGB.size()); // to YCbCr.601
-        for (int i = 0; i < RGB.size(); i+=3) {
-            double R = RGB[i] / 255.0;
-            double G = RGB[i + 1] / 255.0;
-            double B = RGB[i + 2] / 255.0;
-            double Y =   Kr * R + Kg * G + Kb * B;
-            double Cb = (B - Y) / (2 * (1 - Kb));
-            double Cr = (R - Y) / (2 * (1 - Kr));
-            result[i]   = roundToByte((int)(Y*255)); // Y
-            result[i+1] = roundToByte((int)((Cb+0.5)*255)); // Cb
-            result[i+2] = roundToByte((int)((Cr+0.5)*255)); // Cr
-        }
-    } else if (!strcmp(to, "YCbCr.709")) {
-        double Kb = 0.0722;
-        double Kr = 0.2126;
-        double Kg = 0.7152;
-        result.resize(RGB.size()); // to YCbCr.601
-        for (int i = 0; i < RGB.size(); i+=3) {
-            double R = RGB[i] / 255.0;
-            double G = RGB[i + 1] / 255.0;
-            double B = RGB[i + 2] / 255.0;
-            double Y =   Kr * R + Kg * G + Kb * B;
-            double Cb = (B - Y) / (2 * (1 - Kb));
-            double Cr = (R - Y) / (2 * (1 - Kr));
-            result[i]   = roundToByte((int)(Y*255)); // Y
-            result[i+1] = roundToByte((int)((Cb+0.5)*255)); // Cb
-            result[i+2] = roundToByte((int)((Cr+0.5)*255)); // Cr
+        } else if (!strcmp(to, "YCbCr.709")) {
+            double Kb = 0.0722;
+            double Kr = 0.2126;
+            double Kg = 0.7152;
+            result = RGB; // to YCbCr.601
+            for (int i = 0; i < RGB.size(); i+=channels) {
+                double R = RGB[i] / scale;
+                double G = RGB[i + 1] / scale;
+                double B = RGB[i + 2] / scale;
+                double Y =   Kr * R + Kg * G + Kb * B;
+                double Cb = (B - Y) / (2 * (1 - Kb));
+                double Cr = (R - Y) / (2 * (1 - Kr));
+                result[i]   = roundToSample((int)(Y*scale)); // Y
+                result[i+1] = roundToSample((int)((Cb+0.5)*scale)); // Cb
+                result[i+2] = roundToSample((int)((Cr+0.5)*scale)); // Cr
+            }
+        } else if (!strcmp(to, "YCoCg")) {
+            result = RGB; // to YCoCg
+            for (int i = 0; i < RGB.size(); i+=channels) {
+                double R = RGB[i]/scale;
+                double G = RGB[i + 1]/scale;
+                double B = RGB[i + 2]/scale;
+                result[i]   = roundToSample((int)((R/4.0 + G/2.0 + B/4.0)*scale)); // Y
+                result[i+1] = roundToSample((int)((R/2.0 - B/2.0 + 0.5)*scale)); // Co
+                result[i+2] = roundToSample((int)((-R/4.0 + G/2.0 - B/4.0 + 0.5)*scale)); // Cg
+            }
+        } else if (!strcmp(to, "CMY")) {
+            result = RGB; // to CMY
+            for (int i = 0; i < RGB.size(); i+=channels) {
+                double R = RGB[i]/scale;
+                double G = RGB[i + 1]/scale;
+                double B = RGB[i + 2]/scale;
+                result[i]   = roundToSample((int)((1.0-R)*scale)); // C
+                result[i+1] = roundToSample((int)((1.0-G)*scale)); // M
+                result[i+2] = roundToSample((int)((1.0-B)*scale)); // Y
+            }
+        } else {
+            throw std::runtime_error("Error, unsupported input color space!");
         }
-    } else if (!strcmp(to, "YCoCg")) {
-        result.resize(RGB.size()); // to YCoCg
-        for (int i = 0; i < RGB.size(); i+=3) {
-            double R = RGB[i]/255.0;
-            double G = RGB[i + 1]/255.0;
-            double B = RGB[i + 2]/255.0;
-            result[i]   = roundToByte((int)((R/4.0 + G/2.0 + B/4.0)*255)); // Y
-            result[i+1] = roundToByte((int)((R/2.0 - B/2.0 + 0.5)*255)); // Co
-            result[i+2] = roundToByte((int)((-R/4.0 + G/2.0 - B/4.0 + 0.5)*255)); // Cg
+        for (uint64_t i = 0; i < result.size(); i++) {
+            Sample::store(data + i * Sample::Bytes, result[i]);
         }
-    } else if (!strcmp(to, "CMY")) {
-        result.resize(RGB.size()); // to CMY
-        for (int i = 0; i < RGB.size(); i+=3) {
-            double R = RGB[i]/255.0;
-            double G = RGB[i + 1]/255.0;
-            double B = RGB[i + 2]/255.0;
-            result[i]   = roundToByte((int)((1.0-R)*255)); // C
-            result[i+1] = roundToByte((int)((1.0-G)*255)); // M
-            result[i+2] = roundToByte((int)((1.0-B)*255)); // Y
+    });
+}
+
+void PNMImage::streamColorSpace(const char* input, const char* output, uint64_t bandRows, const char* from, const char* to) {
+    streamRows(input, output, bandRows, [&](const PNMHeader& header, byte* rows, uint64_t, uint64_t count) {
+        if (header.channels() != 3 && !(header.channels() == 4 && header.hasAlpha())) {
+            throw std::runtime_error("Error: unable to read this file format!");
         }
-    } else {
-        throw std::runtime_error("Error, unsupported input color space!");
-    }
-    ImageData = result;
+        convertColorSpaceRows(rows, count * header.rowSize(), header.ColourDepth, header.channels(), from, to);
+    });
 }
@@ -2,9 +2,14 @@
 #define LAB_2_PNMIMAGE_H
 
 #include <vector>
+#include <string>
 #include <cstdint>
 #include <iostream>
 #include <fstream>
+#include "PixelBuffer.h"
+#include "PNMStream.h"
+#include "PixelKernels.h"
+#include "ImageView.h"
 
 using byte = unsigned char;
 
@@ -19,13 +24,24 @@ private:
         Point A, B, C, D;
     };
 
-    std::vector<byte> Buffer;
-    std::vector<byte> ImageData;
+    PixelBuffer ImageData;
     uint64_t Size, Width, Height, ColourDepth;
+    uint64_t Channels;     // 1 for P5, 3 for P6, DEPTH for P7
+    std::string TupleType; // P7 only
+    bool Alpha;            // the last channel is alpha
     uint8_t Type;
+    // Mirror and Rotate calls not applied to the pixels yet, Width and Height already follow them.
+    // Operations that treat every pixel alike (Invert, ditherNone, ditherRandom, convertColorSpace) leave it pending.
+    Orientation Pending;
     struct Point start{}, end{};
     struct Rect line{};
 
+    // moves the pixels once for every pending Mirror and Rotate
+    void settle();
+
+    // the pixels of region as they are stored, Pending is not applied to them
+    ImageView storedView(const Region& region);
+
     void drawPoint(int, int, double, byte, double);
 
     double opacity(double x, double y);
@@ -37,6 +53,9 @@ private:
     static double encodeGamma(double value, double gamma);
 
     static double closestPaletteColor(byte px, byte bitRate);
+
+    static void convertColorSpaceRows(byte* data, uint64_t length, uint64_t maxval, uint64_t channels,
+                                      const char* from, const char* to);
 public:
 
     PNMImage(uint64_t Width, uint64_t Height, uint64_t ColourDepth, uint8_t Type);
@@ -49,20 +68,35 @@ public:
 
     PNMImage& operator=(const PNMImage& other);
 
-    static std::vector<byte> ReadBinary(const char*, uint64_t);
+    // One image of a multi-image file, the payload stays where the reader found it.
+    explicit PNMImage(PNMFrame&& frame);
 
-    static void WriteBinary(const char*, const std::vector<byte>&);
+    [[nodiscard]] PNMHeader header() const;
 
-    explicit PNMImage(const char*);
-
-    void Export(const char*);
+    // Appends the image to a multi-image output.
+    void Export(PNMFrameWriter& writer);
 
     void Invert();
 
+    // inverts region only, it is found where the pixels are stored so a pending Mirror or Rotate stays pending
+    void Invert(const Region& region);
+
     void Mirror(int);
 
+    // mirrors the pixels within region, the rest of the image stays where it is
+    void Mirror(int direction, const Region& region);
+
+    // keeps region only, the pixels outside it are never read
+    void crop(const Region& region);
+
     void Rotate(int direction);
 
+    // 2 when maxval is above 255, samples are then stored big-endian
+    [[nodiscard]] uint64_t bytesPerSample() const;
+
+    [[nodiscard]] uint64_t pixelSize() const;
+
+    // grey or RGB samples, either may carry an alpha channel after them
     [[nodiscard]] bool isGrey() const;
 
     [[nodiscard]] bool isColor() const;
@@ -95,7 +129,11 @@ public:
 
     static PNMImage pull3rdByte(const PNMImage& source);
 
-    void convertColorSpace(char* from, char* to);
+    // converts region only, the whole image by default
+    void convertColorSpace(char* from, char* to, const Region& region = Region());
+
+    // Converts an RGB image file (P6, or P7 with an optional alpha) bandRows rows at a time.
+    static void streamColorSpace(const char* input, const char* output, uint64_t bandRows, const char* from, const char* to);
 };
 
 
@@ -0,0 +1,196 @@
+#include "PixelBuffer.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const char* path) : Path(path) {
+#ifndef _WIN32
+    if (Path != "-") {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Error when opening file.");
+        }
+        struct stat st{};
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("Error when accessing file.");
+        }
+        if (S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* mapping = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                Data = static_cast<byte*>(mapping);
+                Size = st.st_size;
+                Mapped = true;
+            }
+        }
+        close(fd);
+        if (Mapped || (S_ISREG(st.st_mode) && st.st_size == 0)) {
+            return;
+        }
+    }
+#endif
+    // no mmap for this file, read it the old way up to its end, pipes and "-" (stdin) have no size
+    std::ifstream file;
+    std::istream* is = &std::cin;
+    if (Path != "-") {
+        file.open(path, std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("Error when opening file.");
+        }
+        is = &file;
+    }
+    const uint64_t chunk = 1 << 16;
+    while (*is) {
+        uint64_t length = Fallback.size();
+        Fallback.resize(length + chunk);
+        is->read(reinterpret_cast<char*>(Fallback.data() + length), chunk);
+        Fallback.resize(length + is->gcount());
+    }
+    if (is->bad()) {
+        throw std::runtime_error("Reading error, file could not be read properly!");
+    }
+    Data = Fallback.data();
+    Size = Fallback.size();
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+    if (Mapped) {
+        munmap(Data, Size);
+    }
+#endif
+}
+
+byte* MappedFile::data() const {
+    return Data;
+}
+
+uint64_t MappedFile::size() const {
+    return Size;
+}
+
+const std::string& MappedFile::path() const {
+    return Path;
+}
+
+PixelBuffer::PixelBuffer(std::shared_ptr<MappedFile> file, uint64_t offset, uint64_t length) {
+    if (offset + length > file->size()) {
+        throw std::runtime_error("Error: Unexpected EOF!");
+    }
+    Data = file->data() + offset;
+    Length = length;
+    File = std::move(file);
+}
+
+PixelBuffer::PixelBuffer(std::vector<byte>&& data) : Owned(std::move(data)) {
+    adopt();
+}
+
+PixelBuffer::PixelBuffer(const PixelBuffer& other) : Owned(other.begin(), other.end()) {
+    adopt();
+}
+
+PixelBuffer::PixelBuffer(PixelBuffer&& other) noexcept {
+    *this = std::move(other);
+}
+
+PixelBuffer& PixelBuffer::operator=(const PixelBuffer& other) {
+    if (this == &other) {
+        return *this;
+    }
+    File.reset();
+    Owned.assign(other.begin(), other.end());
+    adopt();
+    return *this;
+}
+
+PixelBuffer& PixelBuffer::operator=(PixelBuffer&& other) noexcept {
+    if (this == &other) {
+        return *this;
+    }
+    File = std::move(other.File);
+    Owned = std::move(other.Owned);
+    Data = other.Data;
+    Length = other.Length;
+    other.File.reset();
+    other.Owned.clear();
+    other.Data = nullptr;
+    other.Length = 0;
+    return *this;
+}
+
+PixelBuffer& PixelBuffer::operator=(const std::vector<byte>& data) {
+    File.reset();
+    Owned = data;
+    adopt();
+    return *this;
+}
+
+PixelBuffer& PixelBuffer::operator=(std::vector<byte>&& data) {
+    File.reset();
+    Owned = std::move(data);
+    adopt();
+    return *this;
+}
+
+void PixelBuffer::adopt() {
+    Data = Owned.data();
+    Length = Owned.size();
+}
+
+bool PixelBuffer::isMapped() const {
+    return File != nullptr;
+}
+
+void PixelBuffer::detach() {
+    if (!File) {
+        return;
+    }
+    Owned.assign(Data, Data + Length);
+    File.reset();
+    adopt();
+}
+
+void PixelBuffer::detachFrom(const char* path) {
+    // writing over the file we are mapped from would pull the pages from under us
+    if (!File) {
+        return;
+    }
+    std::error_code ec{};
+    if (std::filesystem::equivalent(path, File->path(), ec)) {
+        detach();
+    }
+}
+
+void PixelBuffer::push_back(byte value) {
+    detach();
+    Owned.push_back(value);
+    adopt();
+}
+
+void PixelBuffer::resize(uint64_t length) {
+    detach();
+    Owned.resize(length);
+    adopt();
+}
+
+void PixelBuffer::reserve(uint64_t length) {
+    detach();
+    Owned.reserve(length);
+    adopt();
+}
+
+void PixelBuffer::clear() {
+    File.reset();
+    Owned.clear();
+    adopt();
+}
@@ -0,0 +1,199 @@
+#include "SimdKernels.h"
+#include <algorithm>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define LAB_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+    struct Triple {
+        byte b[3];
+    };
+
+    void invertScalar(byte* data, uint64_t length) {
+        for (uint64_t i = 0; i < length; i++) {
+            data[i] = ~data[i];
+        }
+    }
+
+    void reverseBytesScalar(byte* data, uint64_t length) {
+        std::reverse(data, data + length);
+    }
+
+    void reverseTriplesScalar(byte* data, uint64_t count) {
+        auto* pixels = reinterpret_cast<Triple*>(data);
+        std::reverse(pixels, pixels + count);
+    }
+
+#ifdef LAB_SIMD_X86
+    // Reversals swap a block from the front with one from the back, each turned around in a register,
+    // until the two meet. What is left in the middle goes to the next narrower version.
+
+    __attribute__((target("sse2")))
+    void invertSSE2(byte* data, uint64_t length) {
+        const __m128i ones = _mm_set1_epi8(-1);
+        uint64_t i = 0;
+        for (; i + 16 <= length; i += 16) {
+            auto* p = reinterpret_cast<__m128i*>(data + i);
+            _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), ones));
+        }
+        invertScalar(data + i, length - i);
+    }
+
+    __attribute__((target("avx2")))
+    void invertAVX2(byte* data, uint64_t length) {
+        const __m256i ones = _mm256_set1_epi8(-1);
+        uint64_t i = 0;
+        for (; i + 32 <= length; i += 32) {
+            auto* p = reinterpret_cast<__m256i*>(data + i);
+            _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), ones));
+        }
+        invertSSE2(data + i, length - i);
+    }
+
+    __attribute__((target("avx512f")))
+    void invertAVX512(byte* data, uint64_t length) {
+        const __m512i ones = _mm512_set1_epi8(-1);
+        uint64_t i = 0;
+        for (; i + 64 <= length; i += 64) {
+            byte* p = data + i;
+            _mm512_storeu_si512(p, _mm512_xor_si512(_mm512_loadu_si512(p), ones));
+        }
+        invertAVX2(data + i, length - i);
+    }
+
+    __attribute__((target("ssse3")))
+    void reverseBytesSSSE3(byte* data, uint64_t length) {
+        const __m128i turn = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+        byte* front = data;
+        byte* back = data + length;
+        while (back - front >= 32) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i*>(front));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i*>(back - 16));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(front), _mm_shuffle_epi8(b, turn));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(back - 16), _mm_shuffle_epi8(a, turn));
+            front += 16;
+            back -= 16;
+        }
+        std::reverse(front, back);
+    }
+
+    __attribute__((target("avx2")))
+    void reverseBytesAVX2(byte* data, uint64_t length) {
+        // the shuffle stays within 128-bit lanes, the lanes are swapped after it
+        const __m256i turn = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                              15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+        byte* front = data;
+        byte* back = data + length;
+        while (back - front >= 64) {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i*>(front));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<__m256i*>(back - 32));
+            a = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(a, turn), 0x4E);
+            b = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(b, turn), 0x4E);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(front), b);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(back - 32), a);
+            front += 32;
+            back -= 32;
+        }
+        reverseBytesSSSE3(front, back - front);
+    }
+
+    __attribute__((target("avx512f,avx512bw")))
+    void reverseBytesAVX512(byte* data, uint64_t length) {
+        // the zero-masked forms with every lane kept, the plain ones start from an undefined register
+        // that -Wall reports as uninitialized
+        const __mmask16 all = 0xFFFF;
+        const __m512i turn = _mm512_maskz_broadcast_i32x4(
+                all, _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+        byte* front = data;
+        byte* back = data + length;
+        while (back - front >= 128) {
+            __m512i a = _mm512_loadu_si512(front);
+            __m512i b = _mm512_loadu_si512(back - 64);
+            // bytes turned within each 128-bit lane, then the four lanes in reverse order
+            a = _mm512_shuffle_epi8(a, turn);
+            b = _mm512_shuffle_epi8(b, turn);
+            a = _mm512_maskz_shuffle_i64x2((__mmask8)all, a, a, 0x1B);
+            b = _mm512_maskz_shuffle_i64x2((__mmask8)all, b, b, 0x1B);
+            _mm512_storeu_si512(front, b);
+            _mm512_storeu_si512(back - 64, a);
+            front += 64;
+            back -= 64;
+        }
+        reverseBytesAVX2(front, back - front);
+    }
+
+    // Five pixels fill 15 bytes of a register. The front block is loaded from its first byte and the
+    // back block so that it ends on the last, each load has one byte of a neighbouring pixel that
+    // is written back unchanged.
+    __attribute__((target("ssse3")))
+    void reverseTriplesSSSE3(byte* data, uint64_t count) {
+        const char z = -128; // a shuffle index with the top bit set gives 0
+        const __m128i backToFront = _mm_setr_epi8(13, 14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6, 1, 2, 3, z);
+        const __m128i frontToBack = _mm_setr_epi8(z, 12, 13, 14, 9, 10, 11, 6, 7, 8, 3, 4, 5, 0, 1, 2);
+        const __m128i keepLast = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, -1);
+        const __m128i keepFirst = _mm_setr_epi8(-1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+        byte* front = data;
+        byte* back = data + count * 3;
+        while (back - front >= 32) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i*>(front));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i*>(back - 16));
+            __m128i newFront = _mm_or_si128(_mm_shuffle_epi8(b, backToFront), _mm_and_si128(a, keepLast));
+            __m128i newBack = _mm_or_si128(_mm_shuffle_epi8(a, frontToBack), _mm_and_si128(b, keepFirst));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(front), newFront);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(back - 16), newBack);
+            front += 15;
+            back -= 15;
+        }
+        reverseTriplesScalar(front, (back - front) / 3);
+    }
+#endif
+
+    struct Kernels {
+        void (*Invert)(byte*, uint64_t);
+        void (*ReverseBytes)(byte*, uint64_t);
+        void (*ReverseTriples)(byte*, uint64_t);
+        const char* Name;
+    };
+
+    Kernels pick() {
+#ifdef LAB_SIMD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+            return {invertAVX512, reverseBytesAVX512, reverseTriplesSSSE3, "AVX-512"};
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return {invertAVX2, reverseBytesAVX2, reverseTriplesSSSE3, "AVX2"};
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+            return {invertSSE2, reverseBytesSSSE3, reverseTriplesSSSE3, "SSSE3"};
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return {invertSSE2, reverseBytesScalar, reverseTriplesScalar, "SSE2"};
+        }
+#endif
+        return {invertScalar, reverseBytesScalar, reverseTriplesScalar, "scalar"};
+    }
+
+    const Kernels& kernels() {
+        static const Kernels chosen = pick();
+        return chosen;
+    }
+}
+
+void invertBytes(byte* data, uint64_t length) {
+    kernels().Invert(data, length);
+}
+
+void reverseBytes(byte* data, uint64_t length) {
+    kernels().ReverseBytes(data, length);
+}
+
+void reverseTriples(byte* data, uint64_t count) {
+    kernels().ReverseTriples(data, count);
+}
+
+const char* simdLevel() {
+    return kernels().Name;
+}
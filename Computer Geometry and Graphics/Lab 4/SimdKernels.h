@@ -0,0 +1,24 @@
+#ifndef LAB_1_SIMDKERNELS_H
+#define LAB_1_SIMDKERNELS_H
+
+#include <cstdint>
+
+using byte = unsigned char;
+
+// Byte loops of PixelKernels written with SIMD. The widest set the CPU has is picked once at run time:
+// AVX-512, AVX2, SSSE3 or SSE2 on x86 built with GCC or Clang, plain C++ everywhere else.
+
+// ~ of every byte
+void invertBytes(byte* data, uint64_t length);
+
+// reverses the order of length bytes, a P5 row
+void reverseBytes(byte* data, uint64_t length);
+
+// reverses the order of count three byte pixels, a P6 row
+void reverseTriples(byte* data, uint64_t count);
+
+// name of the instruction set in use, "scalar" without one
+const char* simdLevel();
+
+
+#endif
@@ -1,20 +1,28 @@
 #include <iostream>
 #include <string>
+#include <cstring>
+#include <memory>
+#include <vector>
 #include "PNMImage.h"
 
 using byte = unsigned char;
 
 int main(int argc, char* argv[]) {
-    if (argc != 11) {
+    if (argc >= 3 && strcmp(argv[1], "-p") == 0) { // -p <files>: report the headers, the pixels are never read
+        return probeFiles(argc - 2, argv + 2);
+    }
+    if (argc != 11 && argc != 13 && argc != 15) {
         std::cerr << "Incorrect number of arguments" << std::endl;
         return 1;
     }
 
     char *inputFileName = nullptr, *outputFileName = nullptr;
     char *inputColorSpace = nullptr, *outputColorSpace = nullptr;
-    int inputCount, outputCount;
+    int inputCount = 0, outputCount = 0;
+    uint64_t bandRows = 0; // -s <rows>: stream the image this many rows at a time
+    Region region;         // -c <x,y,width,height>: convert this rectangle only
     try {
-        for (int i = 1; i < 11; ++i) {
+        for (int i = 1; i < argc; ++i) {
             char *inputType = strdup(argv[i++]);
             if (inputType[0] != '-') {
                 std::cerr << "Incorrect arguments" << std::endl;
@@ -40,6 +48,19 @@ int main(int argc, char* argv[]) {
                     outputFileName = strdup(argv[i]);
                     break;
                 }
+                case 'c': {
+                    if (!Region::parse(argv[i], region) || region.isWhole()) {
+                        throw std::runtime_error("Error, invalid region!");
+                    }
+                    break;
+                }
+                case 's': {
+                    if (std::stoll(argv[i]) <= 0) {
+                        throw std::runtime_error("Error, invalid band size!");
+                    }
+                    bandRows = std::stoull(argv[i]);
+                    break;
+                }
                 default: {
                 }
             }
@@ -52,147 +73,157 @@ int main(int argc, char* argv[]) {
         delete outputFileName;
         return 1;
     }
-    PNMImage* main = nullptr;
-    if (inputCount == 3) {
+    if (bandRows > 0) {
         try {
-            int l = strlen(inputFileName)-4;
-            if (inputFileName[l]!='.' || inputFileName[l+1]!='p' || inputFileName[l+2]!='g' || inputFileName[l+3]!='m') {
-                std::cerr << "Error, invalid input format";
-                delete inputColorSpace;
-                delete outputColorSpace;
-                delete inputFileName;
-                delete outputFileName;
-                delete main;
-                return 1;
+            // the other options fill the argument count, so -f, -t, -i or -o may be missing
+            if (!inputFileName || !outputFileName || !inputColorSpace || !outputColorSpace) {
+                throw std::runtime_error("Error, streaming needs -f, -t, -i and -o!");
+            }
+            if (inputCount != 1 || outputCount != 1) {
+                throw std::runtime_error("Error, only single file images can be streamed!");
+            }
+            if (!region.isWhole()) {
+                throw std::runtime_error("Error, a region can not be streamed!");
             }
-            std::string newIntputName(inputFileName);
-            newIntputName = newIntputName.substr(0, newIntputName.find_last_of('.'));
-//            char *input1 = strdup(newIntputName.c_str());
-//            char *input2 = strdup(newIntputName.c_str());
-//            char *input3 = strdup(newIntputName.c_str());
-//            strcat(input1, "_1.pgm");
-//            strcat(input2, "_2.pgm");
-//            strcat(input3, "_3.pgm");
-            PNMImage im1((newIntputName + "_1.pgm").c_str());
-            PNMImage im2((newIntputName + "_2.pgm").c_str());
-            PNMImage im3((newIntputName + "_3.pgm").c_str());
-            main = new PNMImage(PNMImage::mergeBytes(im1, im2, im3));
-//            delete input1;
-//            delete input2;
-//            delete input3;
+            PNMImage::streamColorSpace(inputFileName, outputFileName, bandRows, inputColorSpace, outputColorSpace);
         } catch (const std::exception &e) {
             std::cerr << e.what() << std::endl;
             delete inputColorSpace;
             delete outputColorSpace;
             delete inputFileName;
             delete outputFileName;
-            delete main;
             return 1;
         }
-    } else if (inputCount == 1){
-        try {
-            int l = strlen(inputFileName)-4;
-            if (inputFileName[l]!='.' || inputFileName[l+1]!='p' || inputFileName[l+2]!='p' || inputFileName[l+3]!='m') {
-                std::cerr << "Error, invalid input format";
-                delete inputColorSpace;
-                delete outputColorSpace;
-                delete inputFileName;
-                delete outputFileName;
-                delete main;
-                return 1;
-            }
-            main = new PNMImage(inputFileName);
-        } catch (const std::exception &e) {
-            std::cerr << e.what() << std::endl;
+        delete inputColorSpace;
+        delete outputColorSpace;
+        delete inputFileName;
+        delete outputFileName;
+        return 0;
+    }
+
+    // file names of the channels, a count of 3 means one grey file per channel
+    std::vector<std::string> inputs, outputs;
+    if (inputCount == 3) {
+        int l = strlen(inputFileName)-4;
+        if (inputFileName[l]!='.' || inputFileName[l+1]!='p' || inputFileName[l+2]!='g' || inputFileName[l+3]!='m') {
+            std::cerr << "Error, invalid input format";
+            delete inputColorSpace;
+            delete outputColorSpace;
+            delete inputFileName;
+            delete outputFileName;
+            return 1;
+        }
+        std::string newIntputName(inputFileName);
+        newIntputName = newIntputName.substr(0, newIntputName.find_last_of('.'));
+        inputs = {newIntputName + "_1.pgm", newIntputName + "_2.pgm", newIntputName + "_3.pgm"};
+    } else if (inputCount == 1) {
+        int l = strlen(inputFileName)-4;
+        if (!isStandardStream(inputFileName) && (l < 0 || (strcmp(inputFileName + l, ".ppm") != 0 && strcmp(inputFileName + l, ".pam") != 0))) {
+            std::cerr << "Error, invalid input format";
             delete inputColorSpace;
             delete outputColorSpace;
             delete inputFileName;
             delete outputFileName;
-            delete main;
             return 1;
         }
+        inputs = {inputFileName};
     } else {
         delete inputColorSpace;
         delete outputColorSpace;
         delete inputFileName;
         delete outputFileName;
-        delete main;
         std::cerr << "Error, invalid input count!" << std::endl;
         return 1;
     }
 
-    try {
-        main->convertColorSpace(inputColorSpace, outputColorSpace);
-    } catch (const std::exception &e) {
-        std::cerr << e.what() << std::endl;
-        delete inputColorSpace;
-        delete outputColorSpace;
-        delete inputFileName;
-        delete outputFileName;
-        delete main;
-        return 1;
-    }
-
     if (outputCount == 3) {
-        try {
-            PNMImage im1 = PNMImage::pull1stByte(*main);
-            PNMImage im2 = PNMImage::pull2ndByte(*main);
-            PNMImage im3 = PNMImage::pull3rdByte(*main);
-            int l = strlen(outputFileName) - 4;
-            if (outputFileName[l]!='.' || outputFileName[l+1]!='p' || outputFileName[l+2]!='g' || outputFileName[l+3]!='m') {
-                std::cerr << "Error, invalid output format";
-                delete inputColorSpace;
-                delete outputColorSpace;
-                delete inputFileName;
-                delete outputFileName;
-                delete main;
-                return 1;
-            }
-            std::string newOutputName(outputFileName);
-            newOutputName = newOutputName.substr(0, newOutputName.find_last_of('.'));
-            im1.Export((newOutputName+"_1.pgm").c_str());
-            im2.Export((newOutputName+"_2.pgm").c_str());
-            im3.Export((newOutputName+"_3.pgm").c_str());
-        } catch (const std::exception &e) {
-            std::cerr << e.what() << std::endl;
+        int l = strlen(outputFileName) - 4;
+        if (outputFileName[l]!='.' || outputFileName[l+1]!='p' || outputFileName[l+2]!='g' || outputFileName[l+3]!='m') {
+            std::cerr << "Error, invalid output format";
             delete inputColorSpace;
             delete outputColorSpace;
             delete inputFileName;
             delete outputFileName;
-            delete main;
             return 1;
         }
+        std::string newOutputName(outputFileName);
+        newOutputName = newOutputName.substr(0, newOutputName.find_last_of('.'));
+        outputs = {newOutputName + "_1.pgm", newOutputName + "_2.pgm", newOutputName + "_3.pgm"};
     } else if (outputCount == 1) {
-        try {
-            int l = strlen(outputFileName) - 4;
-            if (outputFileName[l]!='.' || outputFileName[l+1]!='p' || outputFileName[l+2]!='p' || outputFileName[l+3]!='m') {
-                std::cerr << "Error, invalid output format";
-                delete inputColorSpace;
-                delete outputColorSpace;
-                delete inputFileName;
-                delete outputFileName;
-                delete main;
-                return 1;
-            }
-            main->Export(outputFileName);
-        } catch (const std::exception &e) {
-            std::cerr << e.what() << std::endl;
+        int l = strlen(outputFileName) - 4;
+        if (!isStandardStream(outputFileName) && (l < 0 || (strcmp(outputFileName + l, ".ppm") != 0 && strcmp(outputFileName + l, ".pam") != 0))) {
+            std::cerr << "Error, invalid output format";
             delete inputColorSpace;
             delete outputColorSpace;
             delete inputFileName;
             delete outputFileName;
-            delete main;
             return 1;
         }
+        outputs = {outputFileName};
     } else {
         std::cerr << "Error, invalid output count!" << std::endl;
         delete inputColorSpace;
         delete outputColorSpace;
         delete inputFileName;
         delete outputFileName;
-        delete main;
         return 1;
     }
 
+    // every image of a multi-image file is converted in turn, the channel files go frame by frame together
+    try {
+        std::vector<std::unique_ptr<PNMFrameReader>> readers;
+        for (const auto& name : inputs) {
+            readers.push_back(std::make_unique<PNMFrameReader>(name.c_str()));
+        }
+        std::vector<std::unique_ptr<PNMFrameWriter>> writers;
+        for (const auto& name : outputs) {
+            bool source = false;
+            for (const auto& reader : readers) {
+                source = source || reader->isSource(name.c_str());
+            }
+            writers.push_back(std::make_unique<PNMFrameWriter>(name.c_str(), source));
+        }
+
+        while (true) {
+            std::vector<PNMFrame> frames(readers.size());
+            bool more = readers[0]->next(frames[0]);
+            for (uint64_t i = 1; i < readers.size(); i++) {
+                if (readers[i]->next(frames[i]) != more) {
+                    throw std::runtime_error("Error, merging images have different numbers of frames!");
+                }
+            }
+            if (!more) {
+                break;
+            }
+
+            PNMImage main = inputCount == 3
+                    ? PNMImage::mergeBytes(PNMImage(std::move(frames[0])), PNMImage(std::move(frames[1])), PNMImage(std::move(frames[2])))
+                    : PNMImage(std::move(frames[0]));
+            main.convertColorSpace(inputColorSpace, outputColorSpace, region);
+
+            if (outputCount == 3) {
+                PNMImage::pull1stByte(main).Export(*writers[0]);
+                PNMImage::pull2ndByte(main).Export(*writers[1]);
+                PNMImage::pull3rdByte(main).Export(*writers[2]);
+            } else {
+                main.Export(*writers[0]);
+            }
+        }
+        for (auto& writer : writers) {
+            writer->finish();
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        delete inputColorSpace;
+        delete outputColorSpace;
+        delete inputFileName;
+        delete outputFileName;
+        return 1;
+    }
+
+    delete inputColorSpace;
+    delete outputColorSpace;
+    delete inputFileName;
+    delete outputFileName;
     return 0;
 }
\ No newline at end of file